@@ -0,0 +1,67 @@
+//
+// Created by jens on 17/10/26.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "alloc-count.h"
+
+
+/** Number of allocations made so far */
+static std::atomic<std::size_t> allocations{0};
+
+
+std::size_t allocation_count() noexcept
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+
+#ifdef VEC2POLY_COUNT_ALLOCATIONS
+
+/** Allocate n bytes aligned to align, counting the allocation; all of it is released with std::free */
+static void *counted(std::size_t n, std::size_t align = alignof(std::max_align_t)) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(n == 0)
+        n = 1;
+    if(align <= alignof(std::max_align_t))
+        return std::malloc(n);
+    // aligned_alloc needs the size to be a multiple of the alignment
+    return std::aligned_alloc(align, (n + align - 1) / align * align);
+}
+
+
+/** Allocate for the throwing forms of operator new */
+static void *counted_or_throw(std::size_t n, std::size_t align = alignof(std::max_align_t))
+{
+    if(void *p = counted(n, align))
+        return p;
+    throw std::bad_alloc();
+}
+
+
+void *operator new(std::size_t n) { return counted_or_throw(n); }
+void *operator new[](std::size_t n) { return counted_or_throw(n); }
+void *operator new(std::size_t n, std::nothrow_t const &) noexcept { return counted(n); }
+void *operator new[](std::size_t n, std::nothrow_t const &) noexcept { return counted(n); }
+void *operator new(std::size_t n, std::align_val_t a) { return counted_or_throw(n, static_cast<std::size_t>(a)); }
+void *operator new[](std::size_t n, std::align_val_t a) { return counted_or_throw(n, static_cast<std::size_t>(a)); }
+void *operator new(std::size_t n, std::align_val_t a, std::nothrow_t const &) noexcept { return counted(n, static_cast<std::size_t>(a)); }
+void *operator new[](std::size_t n, std::align_val_t a, std::nothrow_t const &) noexcept { return counted(n, static_cast<std::size_t>(a)); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::nothrow_t const &) noexcept { std::free(p); }
+void operator delete[](void *p, std::nothrow_t const &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, std::nothrow_t const &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, std::nothrow_t const &) noexcept { std::free(p); }
+
+#endif // VEC2POLY_COUNT_ALLOCATIONS
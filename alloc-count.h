@@ -0,0 +1,20 @@
+//
+// Counting allocations, for the tests
+// Created by jens on 17/10/26.
+//
+
+#ifndef VEC2POLY_ALLOC_COUNT_H
+#define VEC2POLY_ALLOC_COUNT_H
+
+#include <cstddef>
+
+/** Number of allocations made so far through the global operator new, in any of its forms.
+ *
+ * Counting replaces every form of the global operator new and delete, which costs
+ * an atomic increment per allocation, so it is only done when the build option
+ * VEC2POLY_COUNT_ALLOCATIONS is on (which also defines the macro of the same name);
+ * otherwise the count stays at zero, and tests should not check it.
+ */
+std::size_t allocation_count() noexcept;
+
+#endif //VEC2POLY_ALLOC_COUNT_H
@@ -0,0 +1,132 @@
+//
+// Chunked storage for objects which must never move
+// Created by jens on 17/10/26.
+//
+
+#ifndef VEC2POLY_ARENA_H
+#define VEC2POLY_ARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+/** Arena of objects of type T, allocated in chunks of CHUNK objects.
+ *
+ * Unlike std::vector, growing the arena never moves existing objects,
+ * so pointers and references to them stay valid for the lifetime of the arena
+ * (or until clear() is called).  Objects cannot be removed individually;
+ * they are all released together, chunk by chunk.
+ *
+ * Objects may be read from other threads while one thread at a time adds to the arena
+ * (as the point factory does in concurrent mode), provided each reader learns an object's index
+ * from the writer by some synchronisation of its own.  The chunks are found through a directory
+ * which is never moved or freed while the arena lives: when it fills, a copy twice its size
+ * is published in its place, and readers still holding the old one find the same chunks in it.
+ *
+ * @tparam T type of object stored
+ * @tparam CHUNK number of objects per chunk
+ */
+template<typename T, std::size_t CHUNK = 4096>
+class arena {
+    static_assert(CHUNK > 0, "arena chunks must hold at least one object");
+    /** Every chunk directory made, each twice the size of the one before; the last is the current one */
+    std::vector<std::unique_ptr<T *[]>> dirs_;
+    /** The current chunk directory, published to readers in other threads */
+    std::atomic<T **> dir_;
+    /** Number of chunks of uninitialised storage in the directory, filled in order */
+    std::size_t nchunks_;
+    /** Number of objects constructed */
+    std::size_t size_;
+    std::allocator<T> alloc_;
+
+    /** Add a chunk to the directory, moving to a bigger directory if it is full */
+    void add_chunk()
+    {
+        T **dir = dir_.load(std::memory_order_relaxed);
+        if(dirs_.empty() || nchunks_ == std::size_t{8} << dirs_.size()) {
+            auto &bigger = dirs_.emplace_back(std::make_unique<T *[]>(std::size_t{16} << dirs_.size()));
+            std::copy_n(dir, nchunks_, bigger.get());
+            dir = bigger.get();
+        }
+        dir[nchunks_] = alloc_.allocate(CHUNK);
+        ++nchunks_;
+        dir_.store(dir, std::memory_order_release);
+    }
+public:
+    arena() noexcept : dirs_(), dir_(nullptr), nchunks_(0), size_(0), alloc_() {}
+    arena(arena const &) = delete;
+    arena(arena &&other) noexcept : dirs_(std::move(other.dirs_)), dir_(other.dir_.exchange(nullptr)),
+        nchunks_(std::exchange(other.nchunks_, 0)), size_(std::exchange(other.size_, 0)), alloc_()
+    {
+        other.dirs_.clear();
+    }
+    arena &operator=(arena const &) = delete;
+    arena &operator=(arena &&other) noexcept
+    {
+        if(this != &other) {
+            clear();
+            std::swap(dirs_, other.dirs_);
+            dir_.store(other.dir_.exchange(nullptr));
+            std::swap(nchunks_, other.nchunks_);
+            std::swap(size_, other.size_);
+        }
+        return *this;
+    }
+    ~arena() { clear(); }
+
+    /** Construct a new object at the end of the arena, allocating a new chunk if needed */
+    template<typename... ARGS>
+    T &emplace_back(ARGS &&...args)
+    {
+        auto const off = size_ % CHUNK;
+        if(off == 0 && size_ / CHUNK == nchunks_)
+            add_chunk();
+        T *where = dir_.load(std::memory_order_relaxed)[size_ / CHUNK] + off;
+        std::construct_at(where, std::forward<ARGS>(args)...);
+        ++size_;
+        return *where;
+    }
+
+    [[nodiscard]] T &operator[](std::size_t i) noexcept { return dir_.load(std::memory_order_acquire)[i / CHUNK][i % CHUNK]; }
+    [[nodiscard]] T const &operator[](std::size_t i) const noexcept { return dir_.load(std::memory_order_acquire)[i / CHUNK][i % CHUNK]; }
+
+    [[nodiscard]] T &back() noexcept { return (*this)[size_ - 1]; }
+
+    /** Contiguous runs of objects in index order, one span per chunk */
+    [[nodiscard]] auto chunks() const
+    {
+        return std::views::iota(std::size_t{0}, nchunks_)
+            | std::views::transform([this](std::size_t c)
+                {
+                    return std::span<T const>(dir_.load(std::memory_order_acquire)[c], std::min(CHUNK, size_ - c*CHUNK));
+                });
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+    /** Destroy all objects and release all chunks in one go */
+    void clear() noexcept
+    {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            for(std::size_t i = 0; i < size_; ++i)
+                std::destroy_at(&(*this)[i]);
+        T **dir = dir_.exchange(nullptr);
+        for(std::size_t c = 0; c < nchunks_; ++c)
+            alloc_.deallocate(dir[c], CHUNK);
+        dirs_.clear();
+        nchunks_ = 0;
+        size_ = 0;
+    }
+};
+
+
+#endif //VEC2POLY_ARENA_H
@@ -4,7 +4,7 @@
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/graph_traits.hpp>
 #include <boost/graph/breadth_first_search.hpp>
-#include <map>
+#include <limits>
 #include <utility>
 #include <vector>
 #include "graph-path.h"
@@ -39,12 +39,16 @@ struct graphimpl
 {
     /** Boost implementation of graph */
     Graph g_;
-    /** Nodes are non-negative integers */
-    std::map<pathpoint,node_t> vertex_;
+    /** Node number of each world point, indexed by point id.
+     * Nodes are non-negative integers; points which are not nodes map to invalid */
+    std::vector<node_t> vertex_;
+    /** World point of each node (the inverse of vertex_) */
+    std::vector<pathpoint> point_;
     /** Value of next new node to be added
      * or, equivalently, the size (number of nodes) */
     node_t n_;
-    graphimpl(node_t size) : g_(size), vertex_(), n_(size) {}
+    static constexpr node_t invalid = std::numeric_limits<node_t>::max();
+    graphimpl(node_t size) : g_(size), vertex_(), point_(), n_(size) {}
 };
 
 
@@ -56,22 +60,26 @@ struct graphimpl
 
 static std::unique_ptr<graphimpl> make_graphimpl(world &w)
 {
-    node_t init(0);
-    std::map<pathpoint,node_t> vertices;
+    std::vector<node_t> vertices(std::ranges::size(w.points()), graphimpl::invalid);
+    std::vector<pathpoint> points;
     // First we get the size of the world by creating all the nodes
     // (these are not necessarily branch points as a path may meet only one other path)
-    auto may_add_point = [&init,&vertices](pathpoint p)
+    auto may_add_point = [&vertices,&points](pathpoint p)
     {
-        if(!vertices.contains(p))
-            vertices[p] = init++;
+        node_t &v = vertices[p->id()];
+        if(v == graphimpl::invalid) {
+            v = static_cast<node_t>(points.size());
+            points.push_back(p);
+        }
     };
     for( auto const &p : w.paths() ) {
         auto [a, b] = p.endpoints();
         may_add_point(a);
         may_add_point(b);
     }
-    auto ret = std::make_unique<graphimpl>(init);
+    auto ret = std::make_unique<graphimpl>(points.size());
     std::swap(ret->vertex_, vertices);
+    std::swap(ret->point_, points);
     return ret;
 }
 
@@ -99,6 +107,8 @@ graph::graph() : impl_(std::make_unique<graphimpl>(0))
 
 graph::graph(world &w) : impl_(make_graphimpl(w))
 {
+    if(w.map().size() >= std::numeric_limits<edge_t>::max())
+        throw BadGraph("too many paths for the edge index type");
     /* At this point in construction, the graph has been set up but has no edges
      * Now add the edges - which will also create the vertices - in the graph
      */
@@ -135,14 +145,14 @@ void graph::add_path(const path &p, edge_t i)
 
 node_t graph::vertex(pathpoint p) const
 {
-    auto q = impl_->vertex_.find(p);
-    if(q == impl_->vertex_.end()) {
+    auto const id = p->id();
+    if(id >= impl_->vertex_.size() || impl_->vertex_[id] == graphimpl::invalid) {
         std::ostringstream msg;
         msg << "Unknown vertex (did you \"properise\" the paths?): ";
         msg << p;
         throw BadGraph(msg.str());
     }
-    return q->second;
+    return impl_->vertex_[id];
 }
 
 
@@ -304,10 +314,7 @@ void graph::polygraph(world const &w, polygon &p)
 
 std::ostream &operator<<(std::ostream &os, graph const &g)
 {
-    // Invert the map of points
-    std::vector<pathpoint> pts(g.impl_->n_);
-    for( auto [k,v] : g.impl_->vertex_ )
-        pts[v] = k;
+    auto const &pts = g.impl_->point_;
     using iter = boost::graph_traits<decltype(g.impl_->g_)>::edge_iterator;
     auto [cur,end] = boost::edges(g.impl_->g_);
     while(cur != end) {
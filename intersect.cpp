@@ -0,0 +1,707 @@
+//
+// Created by jens on 17/10/26.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <optional>
+#include <ranges>
+#include <set>
+#include <thread>
+#include <utility>
+#include "intersect.h"
+#include "segindex.h"
+
+
+segbox::segbox(lineseg const &s, std::size_t i) noexcept : seg(i)
+{
+    auto const a = s.first(), b = s.second();
+    std::tie(xlo, xhi) = std::minmax<double>(a->x(), b->x());
+    std::tie(ylo, yhi) = std::minmax<double>(a->y(), b->y());
+}
+
+
+segpack::segpack(std::vector<lineseg> const &segs) : segpack()
+{
+    ax.reserve(segs.size()); ay.reserve(segs.size());
+    bx.reserve(segs.size()); by.reserve(segs.size());
+    for(lineseg const &s : segs)
+        push_back(s);
+}
+
+
+void segpack::push_back(lineseg const &s)
+{
+    auto const a = s.first(), b = s.second();
+    ax.push_back(a->x()); ay.push_back(a->y());
+    bx.push_back(b->x()); by.push_back(b->y());
+}
+
+
+void segpack::push_back(segpack const &from, std::size_t k)
+{
+    ax.push_back(from.ax[k]); ay.push_back(from.ay[k]);
+    bx.push_back(from.bx[k]); by.push_back(from.by[k]);
+}
+
+
+batch_hits intersects(lineseg const &v, segpack const &w, std::size_t first, std::size_t count) noexcept
+{
+    // See intersects(lineseg const &, lineseg const &) for the logic
+    double const ax = v.first()->x(), ay = v.first()->y(), bx = v.second()->x(), by = v.second()->y();
+    double const *cx = w.ax.data() + first, *cy = w.ay.data() + first;
+    double const *dx = w.bx.data() + first, *dy = w.by.data() + first;
+    batch_hits r;
+    std::array<std::uint32_t, batch_width> hit, unsure;
+    // No branches in the loop, so it vectorises; degenerate lanes give infinities which are then ignored
+    for(std::size_t k = 0; k < count; ++k) {
+        auto const o1 = orient_filter(ax, ay, bx, by, cx[k], cy[k]);
+        auto const o2 = orient_filter(ax, ay, bx, by, dx[k], dy[k]);
+        auto const o3 = orient_filter(cx[k], cy[k], dx[k], dy[k], ax, ay);
+        auto const o4 = orient_filter(cx[k], cy[k], dx[k], dy[k], bx, by);
+        // Signs the filter is sure of
+        bool const p1 = o1.det > o1.err, n1 = o1.det < -o1.err, p2 = o2.det > o2.err, n2 = o2.det < -o2.err;
+        bool const p3 = o3.det > o3.err, n3 = o3.det < -o3.err, p4 = o4.det > o4.err, n4 = o4.det < -o4.err;
+        bool const yes = ((p1 & n2) | (n1 & p2)) & ((p3 & n4) | (n3 & p4));
+        bool const no = (p1 & p2) | (n1 & n2) | (p3 & p4) | (n3 & n4);
+        hit[k] = yes;
+        unsure[k] = !yes & !no;
+        r.s[k] = o3.det/(o3.det - o4.det);
+        r.t[k] = o1.det/(o1.det - o2.det);
+    }
+    r.hits = r.unsure = 0;
+    for(std::size_t k = 0; k < count; ++k) {
+        r.hits |= hit[k] << k;
+        r.unsure |= unsure[k] << k;
+    }
+    return r;
+}
+
+
+/** Tests one line segment at a time against candidates collected for it, batch_width at a time,
+ * adding a crossing for each segment which is split by an intersection */
+class batch_tester {
+    std::vector<lineseg> const &segs_;
+    segpack const &pack_;
+    std::vector<crossing> &result_;
+    /** Segment being tested */
+    std::size_t v_;
+    /** Candidates collected so far, and their packed copies */
+    std::array<std::size_t, batch_width> cand_;
+    segpack block_;
+public:
+    batch_tester(std::vector<lineseg> const &segs, segpack const &pack, std::vector<crossing> &result) :
+        segs_(segs), pack_(pack), result_(result), v_(0), cand_(), block_() {}
+    batch_tester(batch_tester const &) = delete;
+    batch_tester &operator=(batch_tester const &) = delete;
+    ~batch_tester() { flush(); }
+
+    /** Test the candidates collected so far, then start collecting for segment v */
+    void start(std::size_t v) { flush(); v_ = v; }
+    void add(std::size_t j)
+    {
+        cand_[block_.size()] = j;
+        block_.push_back(pack_, j);
+        if(block_.size() == batch_width)
+            flush();
+    }
+    void flush();
+};
+
+
+void batch_tester::flush()
+{
+    auto const n = block_.size();
+    if(n == 0)
+        return;
+    auto const h = intersects(segs_[v_], block_, 0, n);
+    for(std::size_t k = 0; k < n; ++k) {
+        auto const j = cand_[k];
+        // Pairs are tested in input order, as the brute force search would
+        auto const [i0, i1] = std::minmax(v_, j);
+        std::optional<point> u;
+        if(h.hits & (1u << k)) {
+            // intersects(first, second) returns the point along the second, which is w[k] or, if j comes first, v
+            u = v_ < j ? crossing_point(block_.ax[k], block_.ay[k], block_.bx[k], block_.by[k], h.t[k])
+                       : crossing_point(pack_.ax[v_], pack_.ay[v_], pack_.bx[v_], pack_.by[v_], h.s[k]);
+        } else if(h.unsure & (1u << k))
+            u = intersects(segs_[i0], segs_[i1]);
+        if(!u)
+            continue;
+        if(!segs_[i0].is_endpoint(*u))
+            result_.push_back({i0, *u});
+        if(!segs_[i1].is_endpoint(*u))
+            result_.push_back({i1, *u});
+    }
+    block_.clear();
+}
+
+
+std::vector<crossing> brute_intersections(std::vector<lineseg> const &segs)
+{
+    segpack const pack(segs);
+    std::vector<crossing> result;
+    {
+        batch_tester test(segs, pack, result);
+        for(std::size_t i = 0; i < segs.size(); ++i) {
+            test.start(i);
+            for(std::size_t j = i+1; j < segs.size(); ++j)
+                test.add(j);
+        }
+    }
+    return result;
+}
+
+
+/** Sweep a vertical line across the boxes, testing every pair of overlapping boxes that accept(a,b) allows.
+ * The boxes are sorted in place; each box is checked against every box still on the sweep line */
+template<typename ACCEPT>
+static void sweep(std::vector<segbox> &boxes, std::vector<lineseg> const &segs, segpack const &pack,
+                  std::vector<crossing> &result, ACCEPT &&accept)
+{
+    std::ranges::sort(boxes, {}, &segbox::xlo);
+    batch_tester test(segs, pack, result);
+    // Segments crossing the sweep line, ie starting left of it and not yet finished
+    std::vector<segbox const *> active;
+    for(segbox const &box : boxes) {
+        test.start(box.seg);
+        auto p = active.begin();
+        while(p != active.end()) {
+            segbox const &other = **p;
+            if(other.xhi < box.xlo) {
+                // Retire segments wholly to the left of the sweep line (order doesn't matter)
+                *p = active.back();
+                active.pop_back();
+                continue;
+            }
+            ++p;
+            if(other.yhi < box.ylo || box.yhi < other.ylo || !accept(other, box))
+                continue;
+            test.add(other.seg);
+        }
+        active.push_back(&box);
+    }
+}
+
+
+std::vector<crossing> interval_sweep_intersections(std::vector<lineseg> const &segs)
+{
+    std::vector<segbox> boxes;
+    boxes.reserve(segs.size());
+    for(std::size_t i = 0; i < segs.size(); ++i)
+        boxes.emplace_back(segs[i], i);
+    std::vector<crossing> result;
+    sweep(boxes, segs, segpack(segs), result, [](segbox const &, segbox const &) { return true; });
+    return result;
+}
+
+
+/** Signed integers of 320 bits, in two's complement, for the exact arithmetic of sweep_intersections.
+ * A crossing of two segments with coordinates below 2^53 has homogeneous coordinates below 2^164,
+ * and comparing it with another takes products below 2^275, so arithmetic modulo 2^320 is exact */
+class int320 {
+    /** Least significant first */
+    std::array<std::uint64_t, 5> limb_;
+public:
+    int320(__int128 v = 0) noexcept : limb_()
+    {
+        limb_[0] = static_cast<std::uint64_t>(v);
+        limb_[1] = static_cast<std::uint64_t>(v >> 64);
+        limb_[2] = limb_[3] = limb_[4] = v < 0 ? ~std::uint64_t{0} : 0;
+    }
+
+    friend int320 operator+(int320 const &a, int320 const &b) noexcept
+    {
+        int320 r;
+        unsigned __int128 carry = 0;
+        for(std::size_t i = 0; i < 5; ++i) {
+            carry += static_cast<unsigned __int128>(a.limb_[i]) + b.limb_[i];
+            r.limb_[i] = static_cast<std::uint64_t>(carry);
+            carry >>= 64;
+        }
+        return r;
+    }
+    int320 operator-() const noexcept
+    {
+        int320 r;
+        for(std::size_t i = 0; i < 5; ++i)
+            r.limb_[i] = ~limb_[i];
+        return r + int320(1);
+    }
+    friend int320 operator-(int320 const &a, int320 const &b) noexcept { return a + -b; }
+    friend int320 operator*(int320 const &a, int320 const &b) noexcept
+    {
+        int320 r;
+        for(std::size_t i = 0; i < 5; ++i) {
+            unsigned __int128 carry = 0;
+            for(std::size_t j = 0; i+j < 5; ++j) {
+                carry += static_cast<unsigned __int128>(a.limb_[i]) * b.limb_[j] + r.limb_[i+j];
+                r.limb_[i+j] = static_cast<std::uint64_t>(carry);
+                carry >>= 64;
+            }
+        }
+        return r;
+    }
+    /** 1, -1, or 0 */
+    [[nodiscard]] int sign() const noexcept
+    {
+        if(limb_[4] >> 63)
+            return -1;
+        return std::ranges::any_of(limb_, [](std::uint64_t l) { return l != 0; });
+    }
+    /** Nearest double, give or take a relative error of 12 units in the last place */
+    explicit operator double() const noexcept
+    {
+        if(sign() < 0)
+            return -static_cast<double>(-*this);
+        double r = 0.0;
+        for(std::size_t i = 5; i-- > 0; )
+            r = r * 0x1p64 + static_cast<double>(limb_[i]);
+        return r;
+    }
+};
+
+
+/** Relative error bound of a coordinate of an hpoint as a double, with room to spare */
+static constexpr double hpoint_errbound = 0x1p-46;
+
+/** A point which need not be on the grid, at (x/w, y/w) with w > 0,
+ * and nearly at (fx, fy), to within hpoint_errbound */
+struct hpoint {
+    int320 x, y, w;
+    double fx, fy;
+
+    hpoint() noexcept : x(), y(), w(1), fx(0.0), fy(0.0) {}
+    hpoint(int320 const &x0, int320 const &y0, int320 const &w0) noexcept : x(x0), y(y0), w(w0),
+        fx(static_cast<double>(x0) / static_cast<double>(w0)), fy(static_cast<double>(y0) / static_cast<double>(w0)) {}
+};
+
+
+/** Sign of u - v for doubles within hpoint_errbound of the values compared, or 0 if too close to tell */
+static int filtered_order(double u, double v) noexcept
+{
+    double const err = hpoint_errbound * (std::fabs(u) + std::fabs(v));
+    return (u - v > err) - (v - u > err);
+}
+
+
+/** Difference of two coordinates, which need not fit in a coordinate */
+static __int128 diff(point::coord_t a, point::coord_t b) noexcept
+{
+    return static_cast<__int128>(a) - b;
+}
+
+
+/** Order of points along the sweep: by x, then by y; -1, 1, or 0 if the points are the same */
+static int sweep_order(point a, point b) noexcept
+{
+    if(a.x() != b.x())
+        return a.x() < b.x() ? -1 : 1;
+    return (a.y() > b.y()) - (a.y() < b.y());
+}
+
+static int sweep_order(hpoint const &a, point b) noexcept
+{
+    // Points on the grid are exact as doubles, so only a's error counts, but the bound covers both
+    if(int const o = filtered_order(a.fx, static_cast<double>(b.x())))
+        return o;
+    if(int const o = (a.x - int320(b.x()) * a.w).sign())
+        return o;
+    if(int const o = filtered_order(a.fy, static_cast<double>(b.y())))
+        return o;
+    return (a.y - int320(b.y()) * a.w).sign();
+}
+
+static int sweep_order(hpoint const &a, hpoint const &b) noexcept
+{
+    if(int const o = filtered_order(a.fx, b.fx))
+        return o;
+    if(int const o = (a.x * b.w - b.x * a.w).sign())
+        return o;
+    if(int const o = filtered_order(a.fy, b.fy))
+        return o;
+    return (a.y * b.w - b.y * a.w).sign();
+}
+
+
+/** Bentley-Ottmann sweep of a vertical line across line segments (see sweep_intersections).
+ *
+ * The sweep stops at every endpoint and every crossing, in sweep_order.  The status holds the segments
+ * crossing the sweep line in order along it, just after the point it is at, with those through the point
+ * in order of slope; crossings are only looked for between segments next to each other in the status.
+ * Endpoints are on the grid, so they are handled with the exact predicates of intersects();
+ * crossings are not, and are compared with wide integers (see int320).
+ */
+class line_sweep {
+    std::vector<lineseg> const &segs_;
+    /** Each segment's endpoints, the first in sweep order first (empty for zero length segments) */
+    std::vector<std::pair<point, point>> ends_;
+    /** Where the sweep line is: an endpoint of a segment, or only a crossing */
+    bool whole_;
+    point p_;
+    hpoint h_;
+
+    /** Which side of the sweep point segment s passes: -1 below, 1 above, 0 through it */
+    [[nodiscard]] int side(std::size_t s) const noexcept
+    {
+        auto const [a, b] = ends_[s];
+        if(whole_)
+            return -orient_exact(a, b, p_);
+        // The floating point filter of intersects(), allowing for the error in the crossing's coordinates
+        auto const o = orient_filter(a.x(), a.y(), b.x(), b.y(), h_.fx, h_.fy);
+        double const dx = static_cast<double>(b.x()) - a.x(), dy = static_cast<double>(b.y()) - a.y();
+        double const err = o.err + hpoint_errbound * (std::fabs(dx) * std::fabs(h_.fy) + std::fabs(dy) * std::fabs(h_.fx));
+        if(o.det > err)
+            return -1;
+        if(o.det < -err)
+            return 1;
+        int320 const ux = diff(b.x(), a.x()), uy = diff(b.y(), a.y());
+        return -(ux * (h_.y - int320(a.y()) * h_.w) - uy * (h_.x - int320(a.x()) * h_.w)).sign();
+    }
+
+    /** Stands for the segments through the sweep point, to look them up in the status */
+    struct through_t {};
+    /** Order of segments along the sweep line.  Every comparison is with a segment through the sweep point
+     * (or with through_t), as the status is only looked up, or added to, at such segments */
+    struct order {
+        using is_transparent = void;
+        line_sweep const *sweep;
+
+        bool operator()(std::size_t s, std::size_t t) const noexcept
+        {
+            int const ss = sweep->side(s), st = sweep->side(t);
+            if(ss != st)
+                return ss < st;
+            if(ss == 0) {
+                // Both through the sweep point: just after it, the one with the lesser slope is below
+                auto const [a, b] = sweep->ends_[s];
+                auto const [c, d] = sweep->ends_[t];
+                __int128 const l = diff(b.x(), a.x()) * diff(d.y(), c.y());
+                __int128 const r = diff(b.y(), a.y()) * diff(d.x(), c.x());
+                if(l != r)
+                    return l > r;
+            }
+            // Collinear segments in input order
+            return s < t;
+        }
+        bool operator()(std::size_t s, through_t) const noexcept { return sweep->side(s) < 0; }
+        bool operator()(through_t, std::size_t t) const noexcept { return sweep->side(t) > 0; }
+    };
+    struct later {
+        bool operator()(hpoint const &a, hpoint const &b) const noexcept { return sweep_order(a, b) < 0; }
+    };
+    /** Segments crossing the sweep line, in order along it */
+    std::set<std::size_t, order> status_;
+    /** Crossings found ahead of the sweep line */
+    std::set<hpoint, later> crossings_;
+
+    /** If segments s and t cross properly, ahead of the sweep point, add the crossing */
+    void look_ahead(std::size_t s, std::size_t t);
+public:
+    explicit line_sweep(std::vector<lineseg> const &segs);
+    line_sweep(line_sweep const &) = delete;
+    line_sweep &operator=(line_sweep const &) = delete;
+
+    void run(std::vector<crossing> &result);
+};
+
+
+line_sweep::line_sweep(std::vector<lineseg> const &segs) : segs_(segs), ends_(), whole_(true), p_(0, 0), h_(),
+    status_(order{this}), crossings_()
+{
+    ends_.reserve(segs_.size());
+    for(lineseg const &s : segs_) {
+        point const a = *s.first(), b = *s.second();
+        if(sweep_order(a, b) <= 0)
+            ends_.emplace_back(a, b);
+        else
+            ends_.emplace_back(b, a);
+    }
+}
+
+
+void line_sweep::look_ahead(std::size_t s, std::size_t t)
+{
+    auto const [a, b] = ends_[s];
+    auto const [c, d] = ends_[t];
+    // As intersects(), but only proper crossings: a crossing at an endpoint is on the grid, and the sweep stops there anyway
+    int const o1 = orient_exact(a, b, c), o2 = orient_exact(a, b, d), o3 = orient_exact(c, d, a), o4 = orient_exact(c, d, b);
+    if(o1 == 0 || o2 == 0 || o3 == 0 || o4 == 0 || o1 == o2 || o3 == o4)
+        return;
+    // a + (b-a) num/den; products of differences fit in 128 bits, as in orient_exact
+    __int128 const ux = diff(b.x(), a.x()), uy = diff(b.y(), a.y()), vx = diff(d.x(), c.x()), vy = diff(d.y(), c.y());
+    __int128 den = ux * vy - uy * vx, num = diff(c.x(), a.x()) * vy - diff(c.y(), a.y()) * vx;
+    if(den < 0) {
+        den = -den;
+        num = -num;
+    }
+    hpoint h(int320(a.x()) * den + int320(num) * ux, int320(a.y()) * den + int320(num) * uy, den);
+    if(whole_ ? sweep_order(h, p_) > 0 : sweep_order(h, h_) > 0)
+        crossings_.insert(std::move(h));
+}
+
+
+void line_sweep::run(std::vector<crossing> &result)
+{
+    // Segments by where the sweep meets them, and where it leaves them
+    std::vector<std::size_t> starts, stops;
+    for(std::size_t s = 0; s < ends_.size(); ++s)
+        if(ends_[s].first != ends_[s].second) {
+            starts.push_back(s);
+            stops.push_back(s);
+        }
+    auto const before = [](point a, point b) { return sweep_order(a, b) < 0; };
+    std::ranges::sort(starts, before, [this](std::size_t s) { return ends_[s].first; });
+    std::ranges::sort(stops, before, [this](std::size_t s) { return ends_[s].second; });
+
+    segpack const pack(segs_);
+    batch_tester test(segs_, pack, result);
+    std::vector<std::size_t> through;
+    std::size_t i = 0, j = 0;
+    while(i < starts.size() || j < stops.size() || !crossings_.empty()) {
+        // Move to the next endpoint or crossing, whichever comes first; a crossing at an endpoint is only visited once
+        std::optional<point> next;
+        if(i < starts.size())
+            next = ends_[starts[i]].first;
+        if(j < stops.size() && (!next || before(ends_[stops[j]].second, *next)))
+            next = ends_[stops[j]].second;
+        int const o = crossings_.empty() ? 1 : next ? sweep_order(*crossings_.begin(), *next) : -1;
+        whole_ = o >= 0;
+        if(whole_)
+            p_ = *next;
+        else
+            h_ = *crossings_.begin();
+        if(o <= 0)
+            crossings_.erase(crossings_.begin());
+        auto const first_start = i;
+        while(whole_ && i < starts.size() && ends_[starts[i]].first == p_)
+            ++i;
+        while(whole_ && j < stops.size() && ends_[stops[j]].second == p_)
+            ++j;
+
+        // Take the segments through the sweep point out of the status; those which go on past it
+        // come first, in status order, and the rest end here
+        auto const [lo, hi] = status_.equal_range(through_t{});
+        auto const below = lo == status_.begin() ? status_.end() : std::prev(lo);
+        through.assign(lo, hi);
+        status_.erase(lo, hi);
+        auto const ending = std::ranges::stable_partition(through,
+            [this](std::size_t s) { return !whole_ || ends_[s].second != p_; }).begin();
+
+        // Every pair of segments meeting here, unless it is an end of both, which is no crossing
+        for(auto s = through.begin(); s != ending; ++s) {
+            test.start(*s);
+            for(auto t = s+1; t != through.end(); ++t)
+                test.add(*t);
+            for(auto k = first_start; k < i; ++k)
+                test.add(starts[k]);
+        }
+
+        // Put back the segments going on past the sweep point, and add those starting here,
+        // now in order just after it
+        for(auto s = through.begin(); s != ending; ++s)
+            status_.insert(*s);
+        for(auto k = first_start; k < i; ++k)
+            status_.insert(starts[k]);
+        if(through.begin() == ending && first_start == i) {
+            if(below != status_.end() && hi != status_.end())
+                look_ahead(*below, *hi);
+        } else {
+            auto const lowest = below == status_.end() ? status_.begin() : std::next(below);
+            if(below != status_.end())
+                look_ahead(*below, *lowest);
+            if(hi != status_.end())
+                look_ahead(*std::prev(hi), *hi);
+        }
+    }
+}
+
+
+std::vector<crossing> sweep_intersections(std::vector<lineseg> const &segs)
+{
+    std::vector<crossing> result;
+    line_sweep(segs).run(result);
+    return result;
+}
+
+
+/** A run of consecutive segments [first,last) of one path along which x strictly increases (or decreases) */
+struct chain {
+    segbox box;
+    std::size_t first, last;
+    bool up;
+};
+
+
+/** Segments of a chain whose x ranges overlap [lo,hi], as a range of segment indices */
+static std::pair<std::size_t,std::size_t> chain_window(chain const &c, segpack const &pack, double lo, double hi)
+{
+    auto const idx = std::views::iota(c.first, c.last);
+    // Segment k of the chain covers x from ax[k] to bx[k] (up) or from bx[k] to ax[k] (down),
+    // and both ends are monotone in k
+    auto const from = c.up ? *std::ranges::partition_point(idx, [&](std::size_t k) { return pack.bx[k] < lo; })
+                           : *std::ranges::partition_point(idx, [&](std::size_t k) { return pack.bx[k] > hi; });
+    auto const rest = std::views::iota(std::min(from, c.last), c.last);
+    auto const to = c.up ? *std::ranges::partition_point(rest, [&](std::size_t k) { return pack.ax[k] <= hi; })
+                         : *std::ranges::partition_point(rest, [&](std::size_t k) { return pack.ax[k] >= lo; });
+    return {from, to};
+}
+
+
+std::vector<crossing> chain_intersections(std::vector<lineseg> const &segs, std::vector<std::size_t> const &paths)
+{
+    segpack const pack(segs);
+    std::vector<chain> chains;
+    // Cut every path into chains, and remember the path of each segment
+    std::vector<std::size_t> path_of(segs.size());
+    for(std::size_t p = 0; p < paths.size(); ++p) {
+        auto const end = p+1 < paths.size() ? paths[p+1] : segs.size();
+        int prev = 0;
+        for(std::size_t k = paths[p]; k < end; ++k) {
+            path_of[k] = p;
+            segbox const box(segs[k], k);
+            int const dir = (pack.bx[k] > pack.ax[k]) - (pack.bx[k] < pack.ax[k]);
+            if(k != paths[p] && dir != 0 && dir == prev) {
+                chains.back().box.cover(box);
+                chains.back().last = k+1;
+            } else
+                chains.push_back({segbox(box.xlo, box.xhi, box.ylo, box.yhi, chains.size()), k, k+1, dir > 0});
+            prev = dir;
+        }
+    }
+
+    std::vector<crossing> result;
+    // Segments which follow each other on a path meet only in their shared point
+    auto adjacent = [&path_of](std::size_t i, std::size_t j)
+    {
+        return (i+1 == j || j+1 == i) && path_of[i] == path_of[j];
+    };
+    // Test the segments of two chains lying in the overlap of their boxes
+    auto test_pair = [&](batch_tester &test, chain const &a, chain const &b)
+    {
+        double const lo = std::max(a.box.xlo, b.box.xlo), hi = std::min(a.box.xhi, b.box.xhi);
+        auto const [a0, a1] = chain_window(a, pack, lo, hi);
+        auto const [b0, b1] = chain_window(b, pack, lo, hi);
+        for(auto i = a0; i < a1; ++i) {
+            segbox const bi(segs[i], i);
+            if(!bi.overlaps(b.box))
+                continue;
+            test.start(i);
+            for(auto j = b0; j < b1; ++j)
+                if(!adjacent(i, j) && bi.overlaps(segbox(segs[j], j)))
+                    test.add(j);
+        }
+    };
+
+    std::vector<segbox> boxes;
+    boxes.reserve(chains.size());
+    for(chain const &c : chains)
+        boxes.push_back(c.box);
+    std::ranges::sort(boxes, {}, &segbox::xlo);
+    batch_tester test(segs, pack, result);
+    // Chains crossing the sweep line, as in sweep()
+    std::vector<segbox const *> active;
+    for(segbox const &box : boxes) {
+        auto p = active.begin();
+        while(p != active.end()) {
+            segbox const &other = **p;
+            if(other.xhi < box.xlo) {
+                *p = active.back();
+                active.pop_back();
+                continue;
+            }
+            ++p;
+            if(other.overlaps(box))
+                test_pair(test, chains[box.seg], chains[other.seg]);
+        }
+        active.push_back(&box);
+    }
+    test.flush();
+    return result;
+}
+
+
+std::vector<crossing> tiled_intersections(std::vector<lineseg> const &segs, unsigned threads)
+{
+    if(segs.empty())
+        return {};
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<segbox> all;
+    all.reserve(segs.size());
+    for(std::size_t i = 0; i < segs.size(); ++i)
+        all.emplace_back(segs[i], i);
+    segbox world{all.front()};
+    for(segbox const &b : all)
+        world.cover(b);
+
+    // A grid of n*n tiles, several per thread so the threads stay busy when the map is uneven
+    auto const n = static_cast<std::size_t>(std::ceil(std::sqrt(8.0 * threads)));
+    double const tw = (world.xhi - world.xlo) / n, th = (world.yhi - world.ylo) / n;
+    auto tile = [n](double v, double lo, double size) -> std::size_t
+    {
+        if(!(size > 0))
+            return 0;
+        return std::min(n-1, static_cast<std::size_t>(std::max(0.0, std::floor((v - lo) / size))));
+    };
+    auto tx = [&](double x) { return tile(x, world.xlo, tw); };
+    auto ty = [&](double y) { return tile(y, world.ylo, th); };
+
+    // Bin every segment into each tile its box overlaps
+    std::vector<std::vector<segbox>> bins(n*n);
+    for(segbox const &b : all)
+        for(auto i = tx(b.xlo); i <= tx(b.xhi); ++i)
+            for(auto j = ty(b.ylo); j <= ty(b.yhi); ++j)
+                bins[i*n+j].push_back(b);
+
+    // Sweep the tiles in parallel, each thread taking the next tile not yet done
+    segpack const pack(segs);
+    std::vector<std::vector<crossing>> found(n*n);
+    std::atomic<std::size_t> next{0};
+    auto work = [&]()
+    {
+        for(std::size_t t = next++; t < n*n; t = next++) {
+            auto const i = t / n, j = t % n;
+            /* A pair of segments crossing a tile border is in several tiles, but it is tested only in the
+             * tile containing the lower left corner of the overlap of their boxes, which is in both boxes */
+            auto mine = [&](segbox const &a, segbox const &b)
+            {
+                return tx(std::max(a.xlo, b.xlo)) == i && ty(std::max(a.ylo, b.ylo)) == j;
+            };
+            sweep(bins[t], segs, pack, found[t], mine);
+        }
+    };
+    {
+        std::vector<std::jthread> pool;
+        for(unsigned k = 1; k < threads; ++k)
+            pool.emplace_back(work);
+        work();
+    }
+
+    // Merge in tile order
+    std::vector<crossing> result;
+    for(auto &f : found)
+        result.insert(result.end(), f.begin(), f.end());
+    return result;
+}
+
+
+std::vector<crossing> index_intersections(std::vector<lineseg> const &segs, segindex const &index)
+{
+    std::vector<crossing> result;
+    segpack const pack(segs);
+    {
+        batch_tester test(segs, pack, result);
+        for(std::size_t i = 0; i < segs.size(); ++i) {
+            test.start(i);
+            index.query(segbox(segs[i], i), [&test,i,&segs](std::size_t j)
+            {
+                // Each pair is found from both ends, so only test it from the first
+                if(i < j && j < segs.size())
+                    test.add(j);
+            });
+        }
+    }
+    return result;
+}
@@ -0,0 +1,189 @@
+//
+// Engines for finding the intersections between line segments
+// Created by jens on 17/10/26.
+//
+
+#ifndef VEC2POLY_INTERSECT_H
+#define VEC2POLY_INTERSECT_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "point.h"
+#include "lineseg.h"
+
+
+/** Bounding box of a line segment.
+ * Two segments can only intersect if their boxes overlap (or touch).
+ * The segment is identified by seg, an index which means whatever the owner of the box wants */
+struct segbox {
+    double xlo, xhi, ylo, yhi;
+    std::size_t seg;
+
+    segbox(double x0, double x1, double y0, double y1, std::size_t i) noexcept : xlo(x0), xhi(x1), ylo(y0), yhi(y1), seg(i) {}
+    segbox(lineseg const &s, std::size_t i) noexcept;
+
+    [[nodiscard]] bool overlaps(segbox const &o) const noexcept
+    {
+        return !(o.xhi < xlo || xhi < o.xlo || o.yhi < ylo || yhi < o.ylo);
+    }
+    /** Grow the box to cover another one */
+    void cover(segbox const &o) noexcept
+    {
+        xlo = std::min(xlo, o.xlo); xhi = std::max(xhi, o.xhi);
+        ylo = std::min(ylo, o.ylo); yhi = std::max(yhi, o.yhi);
+    }
+};
+
+
+/** A point at which a line segment must be split.
+ * The segment is identified by its index in the engine's input */
+struct crossing {
+    std::size_t seg;
+    point at;
+};
+
+
+/** Line segments packed as coordinate columns, for testing many segments at once.
+ * Segment k runs from (ax[k], ay[k]) to (bx[k], by[k]) */
+struct segpack {
+    std::vector<double> ax, ay, bx, by;
+
+    segpack() noexcept : ax(), ay(), bx(), by() {}
+    explicit segpack(std::vector<lineseg> const &segs);
+
+    void push_back(lineseg const &s);
+    /** Copy segment k of another pack to the end of this one */
+    void push_back(segpack const &from, std::size_t k);
+    void clear() noexcept { ax.clear(); ay.clear(); bx.clear(); by.clear(); }
+    [[nodiscard]] std::size_t size() const noexcept { return ax.size(); }
+};
+
+
+/** Largest number of segments tested at once by the batch intersects() */
+inline constexpr std::size_t batch_width = 16;
+
+/** Result of testing one line segment v against a batch of segments w[0..count).
+ * Bit k of hits is set if v and w[k] cross properly (not at an endpoint), decided by the
+ * floating point filter alone; then the crossing is s[k] of the way along v, and t[k] along w[k].
+ * Bit k of unsure is set if the filter could not decide, and the pair must be tested
+ * with intersects(lineseg const &, lineseg const &) */
+struct batch_hits {
+    std::uint32_t hits, unsure;
+    std::array<double, batch_width> s, t;
+};
+
+/** Test one line segment against up to batch_width others at once.
+ *
+ * This is the floating point filter of intersects(lineseg const &, lineseg const &) as a branch free
+ * loop over packed columns, which the compiler vectorises for whatever instruction set it targets
+ * (SSE2 by default; AVX2 or AVX-512 with VEC2POLY_NATIVE on a machine which has them).
+ * The arithmetic is the same, so a pair decided here is decided the same way one at a time,
+ * and crossing_point(w[k], t[k]) is the point intersects(v, w[k]) would return.
+ *
+ * @param v segment to test
+ * @param w packed segments to test against
+ * @param first index of the first segment in w to test
+ * @param count number of segments to test, at most batch_width
+ */
+[[nodiscard]] batch_hits intersects(lineseg const &v, segpack const &w, std::size_t first, std::size_t count) noexcept;
+
+
+/** Find all intersections between line segments by comparing every segment with every other one: O(N^2).
+ *
+ * This is the reference the other engines are checked against.  Like them, it does not
+ * modify the segments, so a segment crossed many times is tested once, not once per piece.
+ *
+ * @param segs line segments to intersect with each other
+ * @return crossings as for interval_sweep_intersections
+ */
+std::vector<crossing> brute_intersections(std::vector<lineseg> const &segs);
+
+
+/** Find all intersections between line segments with a Bentley-Ottmann sweep.
+ *
+ * A vertical line is swept across the segments, stopping at every endpoint and every crossing.
+ * The segments crossing it are kept in order along it, so each new segment, and each pair which
+ * swaps places at a crossing, need only be tested against its neighbours there for crossings ahead.
+ * Where several segments meet, every pair of them is tested with the same intersects() test
+ * as the brute force search, in batches (see segpack).  Crossings are not on the grid, so
+ * they are located exactly with wide integer arithmetic, behind a floating point filter.
+ * For N segments with K pairs meeting other than at an end of both, this is O((N + K) log N),
+ * however the segments overlap in x; where most segments which overlap cross anyway
+ * (as in a dense grid), the other engines do the same work with less overhead.
+ *
+ * Segments are not modified; all intersections are found on the segments as given.
+ *
+ * @param segs line segments to intersect with each other
+ * @return crossings as for interval_sweep_intersections
+ */
+std::vector<crossing> sweep_intersections(std::vector<lineseg> const &segs);
+
+
+/** Find all intersections between line segments by sweeping a vertical line across their x intervals.
+ *
+ * Segments are visited in order of their leftmost x coordinate; each is tested only against
+ * the segments still crossing the sweep line whose y extent overlaps its own, using the same
+ * intersects() test as the brute force search (in batches, see segpack).  The segments crossing
+ * the sweep line are kept in an unordered list, not ordered along it as in Bentley-Ottmann,
+ * so for N segments with at most A crossing any vertical line this is O(N log N + N A):
+ * close to linear for a map of short segments, but back to O(N^2) when most segments
+ * overlap in x (long horizontal segments, say).
+ *
+ * Segments are not modified; all intersections are found on the segments as given.
+ *
+ * @param segs line segments to intersect with each other
+ * @return for each intersecting pair, a crossing for each segment which does not already
+ *         have the intersection as an endpoint, in no particular order
+ */
+std::vector<crossing> interval_sweep_intersections(std::vector<lineseg> const &segs);
+
+
+/** Find all intersections between line segments by sweeping spatial tiles in parallel.
+ *
+ * The segments' bounding box is cut into a grid of tiles, several per thread, and each segment
+ * is binned into every tile its box overlaps.  Each tile is swept as in interval_sweep_intersections
+ * by whichever thread is free.  A pair of segments found in several tiles is only tested
+ * in one of them, so every pair is tested exactly once, as in the serial engines.
+ *
+ * @param segs line segments to intersect with each other
+ * @param threads number of threads to use, including the caller (0 for one per core)
+ * @return crossings as for interval_sweep_intersections, in an order depending on the number of threads
+ */
+std::vector<crossing> tiled_intersections(std::vector<lineseg> const &segs, unsigned threads = 0);
+
+
+/** Find all intersections between line segments by sweeping monotone chains of segments.
+ *
+ * Each path is cut into chains: maximal runs of consecutive segments along which x strictly
+ * increases or strictly decreases (a vertical segment is a chain of its own).  Within a chain,
+ * segments which are not consecutive have disjoint x ranges, and consecutive ones meet only in their
+ * shared point, so no two segments of a chain need testing.  Chains are swept as segments are in
+ * interval_sweep_intersections, with a box test per pair of chains; for chains whose boxes overlap, the
+ * segments in the overlap are found by binary search (as x is monotone along them) and tested in batches.
+ * Consecutive segments of a path in different chains are not tested either.
+ *
+ * @param segs line segments to intersect with each other, each path's segments in order along it
+ * @param paths index in segs of the first segment of each path, in order
+ * @return crossings as for interval_sweep_intersections
+ */
+std::vector<crossing> chain_intersections(std::vector<lineseg> const &segs, std::vector<std::size_t> const &paths);
+
+
+class segindex;
+
+/** Find all intersections between line segments by looking up each segment's neighbours in a spatial index.
+ *
+ * Each segment is tested only against the later segments whose boxes in the index overlap its own,
+ * using the same intersects() test as the brute force search.
+ *
+ * @param segs line segments to intersect with each other
+ * @param index spatial index holding (at least) a box for each segment, numbered as in segs
+ * @return crossings as for interval_sweep_intersections
+ */
+std::vector<crossing> index_intersections(std::vector<lineseg> const &segs, segindex const &index);
+
+
+#endif //VEC2POLY_INTERSECT_H
@@ -18,6 +18,22 @@ point transform::operator()(point p) const noexcept
 }
 
 
+void transform::operator()(std::span<point::coord_t const> xs, std::span<point::coord_t const> ys, std::vector<point> &out) const
+{
+    auto const n = xs.size();
+    // Work column-wise so the arithmetic vectorises, then gather into points
+    std::vector<double> px(n), py(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        px[i] = (static_cast<double>(xs[i]) + dx_) * sx_ + ox_;
+        py[i] = (static_cast<double>(ys[i]) + dy_) * sy_ + oy_;
+    }
+    out.clear();
+    out.reserve(n);
+    for(std::size_t i = 0; i < n; ++i)
+        out.emplace_back(px[i], py[i]);
+}
+
+
 iobase::iobase(toplevel const &t, world const &w, graph const &g) : t_(t), w_(w), g_(g), tf_(), tol_(w.alloc_.tol())
 {
 }
@@ -35,8 +51,9 @@ void iobase::writeworld(std::ostream &os)
 }
 
 
-ioxfig::ioxfig(const toplevel &t, const world &w, const graph &g) : iobase(t, w, g), pppl(0), colour(0)
+ioxfig::ioxfig(const toplevel &t, const world &w, const graph &g) : iobase(t, w, g), pppl(0), colour(0), xy_()
 {
+    // The box covers only the points written, not every point in the world
     bbox bb;
     t.visit(bb);
     switch(bb.npoints) {
@@ -53,20 +70,33 @@ ioxfig::ioxfig(const toplevel &t, const world &w, const graph &g) : iobase(t, w,
     double scale = 1000.0 / std::max(bb.toprx-bb.botlx,bb.topry-bb.botly);
     // scaling Y by -1 to put origin into top left.  Hence the factor 1.5; y maps to (H-y)+H/2 where H is height
     tf_ = transform(dx, dy, scale, -scale, (bb.toprx-bb.botlx)*scale, 1.5*(bb.topry-bb.botly)*scale);
+    tf_(w.xs(), w.ys(), xy_);
 }
 
 
 void ioxfig::writepoint(std::ostream &os, point xy)
+{
+    writecoords(os, tf_(xy));
+}
+
+
+void ioxfig::writepoint(std::ostream &os, pathpoint p)
+{
+    // Points in the world have already been transformed
+    writecoords(os, xy_.empty() ? tf_(*p) : xy_[p->id()]);
+}
+
+
+void ioxfig::writecoords(std::ostream &os, point q)
 {
     if(pppl == pppl_max) {
         os << "\n\t";
         pppl = 0;
     }
-    auto writecoord = [&os](decltype(xy.x()) val)
+    auto writecoord = [&os](point::coord_t val)
     {
         os << ' ' << (val < 0 ? '-' : ' ') << (val < 0 ? -val : val);
     };
-    auto q = tf_(xy);
     writecoord(q.x());
     writecoord(q.y());
 }
@@ -77,9 +107,9 @@ void ioxfig::writepath(std::ostream &os, const path &p)
     auto s = p.size();
     os << "2 1 0 1 " << next_colour() << " 7 50 -1 -1 0.000 0 0 -1 0 0 " << s+1 << '\n';
     for( auto const &ls : p ) {
-        writepoint(os, *ls.first());
+        writepoint(os, ls.first());
         if( 0 == --s )
-            writepoint(os, *ls.second());
+            writepoint(os, ls.second());
     }
     os << '\n';
 }
@@ -93,7 +123,7 @@ void ioxfig::writepolygon(std::ostream &os, const polygon &p)
     os << "2 3 0 1 " << next_colour() << " 7 50 -1 -1 0.000 0 0 -1 0 0 " << s << '\n';
     auto cb = [this, &os](const pathpoint q)
     {
-        this->writepoint(os, static_cast<point>(*q));
+        this->writepoint(os, q);
     };
     pppl = 0;
     trail_walk walker(w_, cb);
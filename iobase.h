@@ -33,6 +33,13 @@ struct transform {
     transform(int dx, int dy, double sx, double sy, int ox, int oy) noexcept : dx_(dx), dy_(dy), sx_(sx), sy_(sy), ox_(ox), oy_(oy) {}
 
     [[nodiscard]] point operator()(point) const noexcept;
+
+    /** Transform columns of coordinates (see pntalloc::xs and ys) in one pass.
+     * @param xs x coordinates
+     * @param ys y coordinates, same length as xs
+     * @param out transformed points, in the same order
+     */
+    void operator()(std::span<point::coord_t const> xs, std::span<point::coord_t const> ys, std::vector<point> &out) const;
 };
 
 
@@ -68,10 +75,15 @@ private:
     const size_t pppl_max = 6;
     /* For giving different colours to different polygons */
     unsigned int colour;
+    /* World points transformed once, up front, indexed by point id */
+    std::vector<point> xy_;
     /* Assign the next colour */
     unsigned int next_colour() noexcept;
+    /* Write an already transformed point */
+    void writecoords(std::ostream &, point);
 protected:
     void writepoint(std::ostream &, point) override;
+    void writepoint(std::ostream &, pathpoint) override;
 public:
     ioxfig(toplevel const &t, world const &w, graph const &g);
 
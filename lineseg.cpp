@@ -7,14 +7,14 @@
 #include <iostream>
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <numeric>
 #include "lineseg.h"
 #include "pntalloc.h"
 
 
-lineseg::lineseg(pntalloc &alloc, pathpoint a, pathpoint b) noexcept : a_(a), b_(b)
+lineseg::lineseg(pntalloc &, pathpoint a, pathpoint b) noexcept : a_(a), b_(b)
 {
-    recalculate(alloc.tol());
 }
 
 
@@ -25,32 +25,49 @@ lineseg lineseg::split_at(pntalloc &alloc, point p)
         throw BadLineSegment();
     pathpoint const q{b_};
     b_ = alloc.make_point(p);
-    dx_ = b_->x() - a_->x(); dy_ = b_->y() - a_->y();
     return alloc.make_lineseg(p, q);
 }
 
 
+int orient_exact(point p, point q, point r) noexcept
+{
+    // Snapped coordinates are less than 2^53, so differences fit in 64 bits and products in 128
+    using wide = __int128;
+    wide const l = static_cast<wide>(q.x() - p.x()) * static_cast<wide>(r.y() - p.y());
+    wide const m = static_cast<wide>(q.y() - p.y()) * static_cast<wide>(r.x() - p.x());
+    return (l > m) - (l < m);
+}
+
+
 std::optional<point> intersects(lineseg const &v, lineseg const &w)
 {
-    // XXX temporary tolerance measure
-    const double tol = 0.001;
-    // Determinant
-    auto det = w.dx_ * v.dy_ - w.dy_ * v.dx_;
-    if( std::fabs(det) < tol )
-        return std::nullopt;
-    // Vector to solve against (see docs for details)
-//    lineseg k(alloc, v.b_, w.b_);
-    auto kdx = w.b_->x()-v.b_->x(), kdy = w.b_->y()-v.b_->y();
-    // s is the coefficient along v; t is the coefficient along w
-    double s = (w.dy_ * kdx - w.dx_ * kdy)/det;
-    double t = (v.dy_ * kdx - v.dx_ * kdy)/det;
-    if(-tol < s && s < 1.0 + tol &&
-       -tol < t && t < 1.0 + tol )
+    point const a{*v.a_}, b{*v.b_}, c{*w.a_}, d{*w.b_};
+    // Which side of one segment each endpoint of the other is on;
+    // the floating point filter decides all but (nearly) degenerate cases
+    auto side = [](point p, point q, point r, double &det) -> int
     {
-        point z{w.b_->x(), w.b_->y()};
-        return point(z.x()-t*w.dx_,z.y()-t*w.dy_);
-    }
-    return std::nullopt;
+        auto const o = orient_filter(p.x(), p.y(), q.x(), q.y(), r.x(), r.y());
+        det = o.det;
+        if(o.det > o.err) return 1;
+        if(o.det < -o.err) return -1;
+        return orient_exact(p, q, r);
+    };
+    double d1, d2, d3, d4;
+    int const o1 = side(a, b, c, d1), o2 = side(a, b, d, d2);
+    // Collinear segments: overlaps are not detected (see TODO)
+    if(o1 == 0 && o2 == 0)
+        return std::nullopt;
+    int const o3 = side(c, d, a, d3), o4 = side(c, d, b, d4);
+    // Both endpoints of one segment on the same side of the other
+    if(o1 == o2 || o3 == o4)
+        return std::nullopt;
+    // An endpoint lying on the other segment is the intersection, exactly
+    if(o1 == 0) return c;
+    if(o2 == 0) return d;
+    if(o3 == 0) return a;
+    if(o4 == 0) return b;
+    // Proper crossing, at the fraction d1/(d1-d2) of the way along w
+    return crossing_point(c.x(), c.y(), d.x(), d.y(), d1/(d1 - d2));
 }
 
 
@@ -97,95 +114,161 @@ std::ostream &operator<<(std::ostream &os, lineseg const &line)
 }
 
 
-path::path(pntalloc &alloc, std::initializer_list<point> q) : path_()
+path::path(pntalloc &alloc, std::initializer_list<point> q) : pts_()
 {
     if(q.size() < 1)
         throw BadPath("Path too short");
-    // adjacent/pairwise not available until C++23... and zip
-    point prev{*q.begin()};
-    for( auto const &y : std::ranges::views::drop(q, 1) ) {
-        path_.emplace_back(alloc.make_lineseg(prev, y));
-        prev = y;
+    pts_.reserve(q.size());
+    for( auto const &y : q ) {
+        pts_.push_back(alloc.make_point(y));
+        // Every point is counted once per segment end, so interior points need another count
+        if(pts_.size() > 1 && pts_.size() < q.size())
+            alloc.incf(pts_.back());
     }
 }
 
 
-// TODO Should this just be default?
-path::path(path const &other) : path_(other.path_)
+path::path(pntalloc &alloc, std::span<double const> xs, std::span<double const> ys) : pts_()
 {
+    pts_ = alloc.make_points(xs, ys);
+    if(pts_.size() < 2)
+        throw BadPath("Path too short");
+    for( std::size_t i = 1; i+1 < pts_.size(); ++i )
+        alloc.incf(pts_[i]);
 }
 
 
-void path::split_path(std::vector<path> &result, const std::vector<point> &at)
+void path::split_path(std::vector<path> &result, std::vector<bool> const &cut)
 {
-    if(at.empty()) return;
-    // p is the main iterator, tracking the search for points to split at;
-    // r lags behind p - or equals p - to track the start of the next path
-    auto p = path_.begin(), r = p;
-    auto const q = path_.end();
-    // The path containing the first segment of the original path is a special case
-    // because it may need joining up to the very last path
-    // (if the path is a loop not starting in a point in the at set)
-    path first;
-    bool done_first = false;
-    while( p != q ) {
-        // Find a line segment starting in any one of the target points
-        auto u = std::find_if(p, q,
-                              [&at](auto const &y) -> bool
-                              {
-                                 point w = *(y.first());
-                                 return std::find( at.cbegin(), at.cend(), w ) != at.cend();
-                              });
-        if(u == q) {
-            // No remaining at-points on the path, nothing left to do
-            // so the current path (*this) will be the last
-            if(first.path_.empty())
-                return;
-            // Otherwise check if we can splice the first path to the last
-            if(first.path_.back().last() == path_.front().first()) {
-                path_.splice(path_.end(), first.path_);
-                // No insertion call for this path; it remains *this
-                return;
-            }
-            // If we get here, first is non-empty but cannot be connected
-            // There will be trouble, later, but for now, save it
-            result.push_back(first);
-            return;
+    // Copy of the points from one cut to another, as a new path
+    auto piece = [this](std::size_t from, std::size_t to)
+    {
+        path p;
+        p.pts_.assign(pts_.begin() + static_cast<std::ptrdiff_t>(from), pts_.begin() + static_cast<std::ptrdiff_t>(to) + 1);
+        return p;
+    };
+    // Find the points (other than the last) where a new path starts; the paths between
+    // one and the next are moved out as they are found
+    constexpr auto none = std::numeric_limits<std::size_t>::max();
+    std::size_t front = none, back = none;
+    for( std::size_t k = 0; k+1 < pts_.size(); ++k )
+        if(cut[pts_[k]->id()]) {
+            if(back != none)
+                result.push_back(piece(back, k));
+            else
+                front = k;
+            back = k;
+        }
+    if(back == none)
+        return;
+    // The path up to the first cut is a special case because it may need joining up
+    // to the very last path (if the path is a loop not starting in a point in the at set)
+    std::optional<path> first;
+    if(front > 0)
+        first = piece(0, front);
+    // The current path (*this) will be the last
+    pts_.erase(pts_.begin(), pts_.begin() + static_cast<std::ptrdiff_t>(back));
+    if(!first)
+        return;
+    // Join the first path to the last if the last is only the final segment,
+    // or if they start and end in the same point (as a loop split once does)
+    if((pts_.size() == 2 || pts_.front() == first->pts_.back()) && pts_.back() == first->pts_.front()) {
+        pts_.insert(pts_.end(), std::next(first->pts_.begin()), first->pts_.end());
+        return;
+    }
+    // If we get here, first cannot be connected
+    // There will be trouble, later, but for now, save it
+    result.push_back(std::move(*first));
+}
+
+
+void path::split_at(pntalloc &alloc, std::span<std::pair<std::size_t, pathpoint> const> at)
+{
+    if(at.empty())
+        return;
+    std::vector<pathpoint> pts;
+    pts.reserve(pts_.size() + at.size());
+    auto c = at.begin();
+    for( std::size_t k = 0; k < pts_.size(); ++k ) {
+        pts.push_back(pts_[k]);
+        for( ; c != at.end() && c->first == k; ++c ) {
+            alloc.incf(c->second);
+            pts.push_back(c->second);
         }
-        if(!done_first) {
-            first.path_.splice(first.path_.begin(), path_,
-                               r, u);
-            r = u;
-            done_first = true;
-        } else {
-            // Otherwise p->u is to become a separate path
-            path next;
-            // Splicing lists does not invalidate iterators
-            next.path_.splice(next.begin(), path_, r, u);
-            r = u;
-            result.push_back(next);
+    }
+    pts_ = std::move(pts);
+}
+
+
+std::size_t path::simplify(pntalloc &alloc, double tol)
+{
+    auto const n = pts_.size();
+    if(n < 3)
+        return 0;
+    // Squared distance of p from the line segment a->b, in grid units
+    auto dist2 = [](point a, point b, point p)
+    {
+        double const dx = b.x() - a.x(), dy = b.y() - a.y(), ux = p.x() - a.x(), uy = p.y() - a.y();
+        double const len2 = dx * dx + dy * dy;
+        double const t = len2 > 0 ? std::clamp((ux * dx + uy * dy) / len2, 0.0, 1.0) : 0.0;
+        return (ux - t * dx) * (ux - t * dx) + (uy - t * dy) * (uy - t * dy);
+    };
+    // An interior point used only by this path is counted twice, once for each of its line segments
+    std::vector<bool> keep(n);
+    keep.front() = keep.back() = true;
+    for( std::size_t k = 1; k+1 < n; ++k )
+        keep[k] = alloc.use_count(pts_[k]) > 2;
+    // Simplify between each pair of kept points, keeping the farthest point between them
+    // if it is too far from the line segment joining them, with an explicit stack of ranges
+    std::vector<std::pair<std::size_t, std::size_t>> todo;
+    for( std::size_t i = 0, j = 1; j < n; ++j )
+        if(keep[j]) {
+            if(j > i+1)
+                todo.emplace_back(i, j);
+            i = j;
         }
-        // And we continue processing the current path from u
-        p = ++u;
+    double const tol2 = tol * tol;
+    while(!todo.empty()) {
+        auto const [i, j] = todo.back();
+        todo.pop_back();
+        std::size_t far = i;
+        double farthest = tol2;
+        for( auto k = i+1; k < j; ++k )
+            if(double const d = dist2(*pts_[i], *pts_[j], *pts_[k]); d > farthest) {
+                farthest = d;
+                far = k;
+            }
+        if(far == i)
+            continue;
+        keep[far] = true;
+        if(far > i+1)
+            todo.emplace_back(i, far);
+        if(j > far+1)
+            todo.emplace_back(far, j);
     }
-    if(!first.path_.empty())
-        path_.splice(path_.end(), first.path_);
-    return;
+    auto const kept = static_cast<std::size_t>(std::ranges::count(keep, true));
+    if(kept == n || (pts_.front() == pts_.back() && kept < 4))
+        return 0;
+    std::size_t m = 0;
+    for( std::size_t k = 0; k < n; ++k )
+        if(keep[k])
+            pts_[m++] = pts_[k];
+        else {
+            alloc.decf(pts_[k]);
+            alloc.decf(pts_[k]);
+        }
+    pts_.resize(m);
+    return n - m;
 }
 
 
 point path::testpoint() const
 {
-    auto beg = path_.cbegin();
-    auto end = path_.cend();
     // If we have more than one segment, return the end of the first segment
-    auto as_point = [](pathpoint p) -> point { return *p; };
-    lineseg const &first = *beg++;
-    if(beg != end)
-        // By construction, the endpoint of the first segment is the start of the second
-        return as_point(first.second());
+    if(size() > 1)
+        return *pts_[1];
     // If not, we try the midpoint
-    point a{as_point(first.first())}, b{as_point(first.second())};
+    point a{*pts_[0]}, b{*pts_[1]};
     point u{ std::midpoint(a.x(),b.x()), std::midpoint(a.y(),b.y())};
     // Pathological case: if the line segment is very short, the midpoint might be squashed into an endpoint
     if(a == u || b == u)
@@ -196,8 +279,8 @@ point path::testpoint() const
 
 std::ostream &operator<<(std::ostream &os, path const &p)
 {
-    for(auto const &p : p.path_)
-        os << p;
+    for(lineseg const &s : p)
+        os << s;
     return os;
 }
 
@@ -205,13 +288,8 @@ std::ostream &operator<<(std::ostream &os, path const &p)
 void path::points(std::function<void(pathpoint)> cb) const
 {
     // can't happen
-    if(path_.empty())
+    if(pts_.empty())
         throw BadPath("points called on empty path");
-    cb(path_.front().first());
-    auto p = path_.cbegin();
-    auto const q = path_.cend();
-    while(p != q) {
-        cb(p->second());
-        ++p;
-    }
+    for( pathpoint q : pts_ )
+        cb(q);
 }
@@ -5,8 +5,10 @@
 #ifndef VEC2POLY_LINESEG_H
 #define VEC2POLY_LINESEG_H
 
+#include <algorithm>
+#include <cmath>
 #include <optional>
-#include <list>
+#include <span>
 #include <vector>
 #include <set>
 #include <iosfwd>
@@ -31,24 +33,55 @@ public:
 
 class pntalloc;
 
+
+/** Orientation predicates, used by intersects().
+ *
+ * The orientation of r relative to the line p->q is the sign of the cross product (q-p)x(r-p):
+ * positive if r is to the left, negative if to the right, and zero if the three points are collinear.
+ * It is first computed in floating point with an error bound (see Shewchuk, "Adaptive precision
+ * floating-point arithmetic and fast robust geometric predicates", 1997); only if the result is
+ * within the error bound of zero is it recomputed exactly in integers.
+ */
+
+/** Relative error bound of orient_filter (Shewchuk's ccwerrboundA, with epsilon = 2^-53) */
+inline constexpr double orient_errbound = (3.0 + 16.0 * 0x1p-53) * 0x1p-53;
+
+/** Floating point orientation and the bound on its error */
+struct orient_t {
+    double det, err;
+};
+
+/** Floating point orientation of r relative to p->q.
+ * The sign of det is right if |det| > err; coordinates must be exact (as grid coordinates are) */
+inline orient_t orient_filter(double px, double py, double qx, double qy, double rx, double ry) noexcept
+{
+    double const l = (qx - px) * (ry - py), r = (qy - py) * (rx - px);
+    return {l - r, orient_errbound * (std::fabs(l) + std::fabs(r))};
+}
+
+/** Exact orientation of r relative to p->q: 1, -1, or 0 if collinear */
+int orient_exact(point p, point q, point r) noexcept;
+
+/** Point at parameter t along c->d, rounded to the grid (t is clamped to the segment) */
+inline point crossing_point(double cx, double cy, double dx, double dy, double t) noexcept
+{
+    t = std::clamp(t, 0.0, 1.0);
+    return {static_cast<point::coord_t>(std::round(cx + t * (dx - cx))),
+            static_cast<point::coord_t>(std::round(cy + t * (dy - cy)))};
+}
+
+
 class lineseg {
 private:
-    /** The line segment is a point from A to B */
+    /** The line segment is a point from A to B.
+     * The vector A->B is not cached: it is cheap to recalculate from the
+     * endpoints, which have to be read anyway, and it doubles the size of the segment */
     pathpoint a_, b_;
-    /** Once the points are defined we can calculate the vector A->B */
-    double dx_, dy_;
-    void recalculate(double tol)
-    {
-        dx_ = b_->x() - a_->x();
-        dy_ = b_->y() - a_->y();
-#if 0
-        if(dx_*dx_+dy_*dy_ < point::tol2)
-            throw BadLineSegment();
-#endif
-    }
 
     // Constructor become private as the point allocator pntalloc now constructs line segments, too
     lineseg(pntalloc &, pathpoint a, pathpoint b) noexcept;
+    /** A line segment between adjacent points of a path, which already count it (see path::const_iterator) */
+    lineseg(pathpoint a, pathpoint b) noexcept : a_(a), b_(b) {}
 
 public:
     /* Note copying a line segment should not increase the use counter */
@@ -92,7 +125,9 @@ public:
 
     // access to constructor
     friend class pntalloc;
+    friend class path;
 
+    /** Point where two line segments meet, if they do (in a single point) */
     friend std::optional<point> intersects(lineseg const &v, lineseg const &w);
     friend std::ostream &operator<<(std::ostream &, lineseg const &);
 };
@@ -113,48 +148,99 @@ class world;
  */
 class path {
 private:
-    /** List of line segments forming this path.
-     * Line segments should be connected and non-degenerate (not a point)
+    /** Points of the path, in order; line segment k runs from pts_[k] to pts_[k+1].
+     * A path has at least two points, and line segments should be non-degenerate (not a point)
      */
-    std::list<lineseg> path_;
+    std::vector<pathpoint> pts_;
     /** Empty path constructor is private as worlds are not allowed to have empty paths */
-    path() : path_{} {}
+    path() : pts_{} {}
 public:
+    /** Iterator over the line segments of a path, which are made from adjacent points as they are visited */
+    class const_iterator {
+        std::vector<pathpoint>::const_iterator p_;
+    public:
+        using value_type = lineseg;
+        using difference_type = std::ptrdiff_t;
+        const_iterator() noexcept : p_() {}
+        explicit const_iterator(std::vector<pathpoint>::const_iterator p) noexcept : p_(p) {}
+        lineseg operator*() const noexcept { return {p_[0], p_[1]}; }
+        /** The line segment only lives as long as the arrow, so it is held in one */
+        struct arrow {
+            lineseg s;
+            lineseg const *operator->() const noexcept { return &s; }
+        };
+        arrow operator->() const noexcept { return {**this}; }
+        const_iterator &operator++() noexcept { ++p_; return *this; }
+        const_iterator operator++(int) noexcept { auto i{*this}; ++p_; return i; }
+        const_iterator &operator--() noexcept { --p_; return *this; }
+        const_iterator operator--(int) noexcept { auto i{*this}; --p_; return i; }
+        bool operator==(const_iterator const &) const noexcept = default;
+    };
+
     /** Construct path connecting at least two points */
     path(pntalloc &alloc, std::initializer_list<point> q);
-    path(path const &);
-    path(path &&) = default;
-    path &operator=(path const &) = default;
-    path &operator=(path &&) = default;
+    /** Construct path through at least two unsnapped points, given as coordinate columns */
+    path(pntalloc &alloc, std::span<double const> xs, std::span<double const> ys);
+    /** Paths are only moved, so their points are never copied */
+    path(path const &) = delete;
+    path(path &&) noexcept = default;
+    path &operator=(path const &) = delete;
+    path &operator=(path &&) noexcept = default;
 
     /** Return a pair of first and last point */
     auto endpoints() const
     {
-        return std::make_pair(path_.front().first(), path_.back().last());
+        return std::make_pair(pts_.front(), pts_.back());
     }
 
-    /** Split the path at every one of the given points.
+    /** Split the path at every one of the given points, in one pass along it.
      * Additional paths will be added to the result vector.
-     * @tparam newpath inserter callback for new paths
-     * @tparam at Points to split at
+     * @param result new paths are added here
+     * @param cut Points to split at, as a flag for each point id
+     */
+    void split_path(std::vector<path> &result, std::vector<bool> const &cut);
+
+    /** Split line segments of the path at the given points.
+     *
+     * Each entry (k, q) splits line segment k, numbered as before any splitting, at q;
+     * entries are sorted by k, and then by distance along the segment.  Each line segment
+     * k is then replaced by A->Q1, Q1->Q2, ..., Qn->B, so later segments move up.
+     * The points must already have been made by the point factory, and be distinct and not endpoints;
+     * as each is used by two segments, its use count is incremented once more here.
+     *
+     * @param alloc the point factory which made the points, and keeps their use counts
+     * @param at Line segments and points to split them at
      */
-    void split_path(std::vector<path> &result, const std::vector<point> &at);
+    void split_at(pntalloc &alloc, std::span<std::pair<std::size_t, pathpoint> const> at);
+
+    /** Simplify the path (Douglas-Peucker), dropping points which are within tol of the simplified path.
+     * The endpoints, and any point used by other line segments than the path's own, are kept,
+     * so the path still meets other paths where it did.  A loop is left alone if it would
+     * have fewer than three line segments.
+     * @param alloc the point factory which made the points, and keeps their use counts
+     * @param tol distance, in grid units
+     * @return the number of points dropped
+     */
+    std::size_t simplify(pntalloc &alloc, double tol);
 
     bool operator==(path const &) const noexcept = default;
 
     /** Return a point somewhere internal to the path */
     point testpoint() const;
 
-    auto begin() const noexcept { return path_.begin(); }
-    auto end() const noexcept { return path_.end(); }
-    auto rbegin() const noexcept { return path_.rbegin(); }
-    auto rend() const noexcept { return path_.rend(); }
+    const_iterator begin() const noexcept { return const_iterator(pts_.begin()); }
+    const_iterator end() const noexcept { return const_iterator(std::prev(pts_.end())); }
+    auto rbegin() const noexcept { return std::reverse_iterator(end()); }
+    auto rend() const noexcept { return std::reverse_iterator(begin()); }
+
+    /** Line segment k of the path */
+    lineseg operator[](std::size_t k) const noexcept { return {pts_[k], pts_[k+1]}; }
 
     /** call back for every point on the path */
     void points(std::function<void(pathpoint)>) const;
 
-    /** Return size of list, so potentially O(N) complexity */
-    auto size() const noexcept { return path_.size(); }
+    /** Number of line segments */
+    auto size() const noexcept { return pts_.size() - 1; }
     /* This breaks encapsulation but can be Fixed Later(tm) */
     friend class world;
     friend std::ostream &operator<<(std::ostream &, path const &);
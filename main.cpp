@@ -1,7 +1,11 @@
 #include <iostream>
+#include <string_view>
 
 int tests();
+int benchmarks();
 
-int main() {
+int main(int argc, char **argv) {
+    if(argc > 1 && std::string_view(argv[1]) == "bench")
+        return benchmarks();
     return tests();
 }
@@ -3,11 +3,19 @@
 //
 
 #include "perf.h"
+#include "snapshot.h"
+#include "graph-path.h"
 #include <bit>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
 #include <limits>
+#include <type_traits>
+#include <utility>
+#include <unistd.h>
 
 
-using bigint_t = long;
+using bigint_t = point::coord_t;
 
 
 // Separators are at 0 and even powers of two (see docs/perf.fig)
@@ -49,5 +57,185 @@ bool is_separator(bigint_t value)
         return true;
     if(value <= 1)
         return false;
-    return std::popcount(static_cast<unsigned long>(value)) == 1;
+    return std::popcount(static_cast<std::make_unsigned_t<bigint_t>>(value)) == 1;
+}
+
+
+void bench_build(std::ostream &os, unsigned int maxsize)
+{
+    using clock = std::chrono::steady_clock;
+    os << "size\tpoints\tpaths\tbuild(us)\n";
+    for( unsigned int k = 1; k <= maxsize; ++k ) {
+        auto start = clock::now();
+        world w = make_big_world(k);
+        auto stop = clock::now();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(stop-start).count();
+        os << k << '\t' << std::ranges::size(w.points()) << '\t'
+           << w.map().size() << '\t' << us << '\n';
+    }
+}
+
+
+void bench_split(std::ostream &os, unsigned int maxsize, unsigned int maxbrute)
+{
+    using clock = std::chrono::steady_clock;
+    using method = world::split_method_t;
+    // Returns the time taken and the number of segments after splitting
+    auto split = [](unsigned int k, method m) -> std::pair<long long, std::size_t>
+    {
+        world w = make_big_world(k);
+        auto start = clock::now();
+        w.split_segments(m);
+        auto stop = clock::now();
+        return {std::chrono::duration_cast<std::chrono::microseconds>(stop-start).count(),
+                std::ranges::distance(w.segments())};
+    };
+    os << "size\tsegs\tsplit\tbrute(us)\tsweep(us)\tintervals(us)\tindex(us)\ttiled(us)\tchains(us)\n";
+    for( unsigned int k = 1; k <= maxsize; ++k ) {
+        world w = make_big_world(k);
+        auto const [intervals, nsplit] = split(k, method::SPLIT_INTERVALS);
+        os << k << '\t' << std::ranges::distance(w.segments()) << '\t' << nsplit << '\t';
+        if(k <= maxbrute)
+            os << split(k, method::SPLIT_BRUTE).first;
+        else
+            os << '-';
+        os << '\t' << split(k, method::SPLIT_SWEEP).first << '\t' << intervals << '\t' << split(k, method::SPLIT_INDEX).first
+           << '\t' << split(k, method::SPLIT_TILED).first << '\t' << split(k, method::SPLIT_CHAINS).first << '\n';
+    }
+}
+
+
+/** Time incremental splitting of a path added to a split world (see perf.h) */
+void bench_add(std::ostream &os, unsigned int maxsize)
+{
+    using clock = std::chrono::steady_clock;
+    os << "size\tsegs\tadd(us)\n";
+    for( unsigned int k = 1; k <= maxsize; ++k ) {
+        world w = make_big_world(k);
+        w.split_segments(world::split_method_t::SPLIT_INTERVALS);
+        auto const segs = std::ranges::distance(w.segments());
+        auto const limit = static_cast<bigint_t>(1) << k;
+        // The first incremental split also packs the pieces split off by the full split into the index
+        w.add_path({{-1,0},{0,-1}});
+        w.split_segments();
+        auto start = clock::now();
+        // Crosses a few lines of the world, off the grid points
+        w.add_path({{limit/2-3,limit/2},{limit/2+3,limit/2+1}});
+        w.split_segments();
+        auto stop = clock::now();
+        os << k << '\t' << segs << '\t'
+           << std::chrono::duration_cast<std::chrono::microseconds>(stop-start).count() << '\n';
+    }
+}
+
+
+void bench_proper(std::ostream &os, unsigned int maxsize)
+{
+    using clock = std::chrono::steady_clock;
+    // Returns the time taken and the number of paths after
+    auto proper = [](unsigned int k, unsigned int threads) -> std::pair<long long, std::size_t>
+    {
+        world w = make_big_world(k);
+        w.split_segments(world::split_method_t::SPLIT_INTERVALS);
+        auto start = clock::now();
+        w.proper_paths({}, threads);
+        auto stop = clock::now();
+        return {std::chrono::duration_cast<std::chrono::microseconds>(stop-start).count(), w.map().size()};
+    };
+    os << "size\tpaths\tproper\tone(us)\tall(us)\n";
+    for( unsigned int k = 1; k <= maxsize; ++k ) {
+        world w = make_big_world(k);
+        auto const [one, nproper] = proper(k, 1);
+        os << k << '\t' << w.map().size() << '\t' << nproper << '\t' << one << '\t' << proper(k, 0).first << '\n';
+    }
+}
+
+
+void bench_snapshot(std::ostream &os, unsigned int maxsize)
+{
+    using clock = std::chrono::steady_clock;
+    auto us = [](clock::time_point start, clock::time_point stop)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(stop-start).count();
+    };
+    // A file of our own, out of the way and removed however the benchmark ends
+    struct temp_file {
+        std::string name;
+        temp_file() : name((std::filesystem::temp_directory_path() / ("vec2poly-bench-" + std::to_string(::getpid()) + ".v2p")).string()) {}
+        ~temp_file() { std::filesystem::remove(name); }
+    } const tmp;
+    auto const &file = tmp.name;
+    os << "size\tsegs\tprepare(us)\twrite(us)\tload(us)\n";
+    for( unsigned int k = 1; k <= maxsize; ++k ) {
+        world w = make_big_world(k);
+        auto const t0 = clock::now();
+        w.split_segments(world::split_method_t::SPLIT_INTERVALS);
+        w.proper_paths();
+        auto const t1 = clock::now();
+        w.write_snapshot(file);
+        auto const t2 = clock::now();
+        snapshot const snap(file);
+        world const v(snap);
+        auto const t3 = clock::now();
+        os << k << '\t' << std::ranges::distance(w.segments()) << '\t' << us(t0, t1) << '\t'
+           << us(t1, t2) << '\t' << us(t2, t3) << '\n';
+    }
+}
+
+
+void bench_hilbert(std::ostream &os, unsigned int maxsize)
+{
+    using clock = std::chrono::steady_clock;
+    auto us = [](clock::time_point start, clock::time_point stop)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(stop-start).count();
+    };
+    // Mean distance in memory between the ends of a path
+    auto gap = [](world const &w)
+    {
+        double sum = 0.0;
+        for( path const &p : w.map() ) {
+            auto const [a, b] = p.endpoints();
+            sum += static_cast<double>(std::max(a->id(), b->id()) - std::min(a->id(), b->id()));
+        }
+        return sum / static_cast<double>(w.map().size());
+    };
+    // Make the graph and search all of it
+    auto search = [&us](world &w)
+    {
+        auto const start = clock::now();
+        graph g(w);
+        try {
+            g.pathfinder(0, [](node_t) { return false; }, {});
+        }
+        catch(BadGraph const &) {
+        }
+        return us(start, clock::now());
+    };
+    os << "size\tpaths\tgap\thilbert\torder(us)\tgraph(us)\thilbert(us)\n";
+    for( unsigned int k = 1; k <= maxsize; ++k ) {
+        world w = make_big_world(k);
+        w.split_segments(world::split_method_t::SPLIT_INTERVALS);
+        w.proper_paths();
+        auto const before = gap(w);
+        auto const plain = search(w);
+        auto const t0 = clock::now();
+        w.hilbert_order();
+        auto const t1 = clock::now();
+        os << k << '\t' << w.map().size() << '\t' << before << '\t' << gap(w) << '\t' << us(t0, t1)
+           << '\t' << plain << '\t' << search(w) << '\n';
+    }
+}
+
+
+/** Entry point for "vec2poly bench" */
+int benchmarks()
+{
+    bench_build(std::cout, 12);
+    bench_split(std::cout, 10, 7);
+    bench_add(std::cout, 10);
+    bench_proper(std::cout, 10);
+    bench_snapshot(std::cout, 10);
+    bench_hilbert(std::cout, 10);
+    return 0;
 }
@@ -7,6 +7,7 @@
 #ifndef VEC2POLY_PERF_H
 #define VEC2POLY_PERF_H
 
+#include <iosfwd>
 #include "world.h"
 
 /** Make a big world for performance testing.
@@ -18,4 +19,78 @@
  */
 world make_big_world(unsigned int size);
 
+
+/** Time building big worlds of increasing size.
+ *
+ * Writes one line per size: size, number of points, number of paths,
+ * and the wall clock time (in microseconds) taken to build the world.
+ *
+ * @param os stream to write the results to
+ * @param maxsize largest world size to build
+ */
+void bench_build(std::ostream &os, unsigned int maxsize);
+
+
+/** Time splitting big worlds of increasing size with each split method.
+ *
+ * Writes one line per size: size, number of segments before splitting,
+ * number after, and the wall clock time (in microseconds) taken by each method
+ * (brute force, sweep line, interval sweep, spatial index, tiled on all cores, and monotone chains).
+ * The brute force method is only timed up to size maxbrute, as it is O(N^2).
+ *
+ * @param os stream to write the results to
+ * @param maxsize largest world size to split
+ * @param maxbrute largest world size to split by brute force
+ */
+void bench_split(std::ostream &os, unsigned int maxsize, unsigned int maxbrute);
+
+
+/** Time adding a path to split big worlds of increasing size.
+ *
+ * Writes one line per size: size, number of segments after splitting,
+ * and the wall clock time (in microseconds) taken to add a short path
+ * in the middle of the world and split it into the world incrementally.
+ *
+ * @param os stream to write the results to
+ * @param maxsize largest world size
+ */
+void bench_add(std::ostream &os, unsigned int maxsize);
+
+
+/** Time making proper paths in split big worlds of increasing size.
+ *
+ * Writes one line per size: size, number of paths before splitting,
+ * number of proper paths, and the wall clock time (in microseconds) taken
+ * by proper_paths on one thread and on all cores.
+ *
+ * @param os stream to write the results to
+ * @param maxsize largest world size
+ */
+void bench_proper(std::ostream &os, unsigned int maxsize);
+
+
+/** Time saving split big worlds of increasing size to snapshots, and restoring them.
+ *
+ * Writes one line per size: size, number of segments after splitting, and the wall clock
+ * time (in microseconds) taken to split the world and make proper paths, to write
+ * the snapshot, and to map it and restore the world from it.
+ *
+ * @param os stream to write the results to
+ * @param maxsize largest world size
+ */
+void bench_snapshot(std::ostream &os, unsigned int maxsize);
+
+
+/** Measure the locality gained by ordering split big worlds along a Hilbert curve.
+ *
+ * Writes one line per size: size, number of proper paths, the mean difference between the
+ * point ids at the ends of a path, as made and after world::hilbert_order, the time taken
+ * (in microseconds) to reorder, and the time taken to make the graph and search it
+ * breadth first from its first node, as made and after reordering.
+ *
+ * @param os stream to write the results to
+ * @param maxsize largest world size
+ */
+void bench_hilbert(std::ostream &os, unsigned int maxsize);
+
 #endif //VEC2POLY_PERF_H
@@ -3,24 +3,175 @@
 //
 
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
 #include "pntalloc.h"
 
 
-pntalloc::pntalloc(double tol) noexcept : tol_(tol)
+/** Snapped coordinates at least this large are not exact integers in a double
+ * (or do not fit in a coordinate) */
+static constexpr double snap_limit = std::min(0x1p53, static_cast<double>(std::numeric_limits<point::coord_t>::max()));
+
+
+/** Check a snapped coordinate is representable; NaN fails, too */
+static inline bool snaps_exactly(double u) noexcept
 {
-    // XXX temporary work
-    mem_.reserve(1000);
+    return std::fabs(u) < snap_limit;
+}
+
+
+pntalloc::pntalloc(double tol, bool concurrent) : mem_(), xs_(), ys_(), counts_(),
+    shards_(), nshards_(concurrent ? concurrent_shards : 1), grow_(std::make_unique<std::mutex>()),
+    near_(std::make_unique<std::mutex>()), concurrent_(concurrent), snap_(snap_type_t::SNAP_GRID), tol_(tol), inv_tol_(1.0/tol), unindexed_(0)
+{
+    shards_ = std::make_unique<shard[]>(nshards_);
 }
 
 
 pathpoint pntalloc::make_point(point z)
 {
-    auto u = lookup(z);
-    if( u == -1 ) {
-        mem_.emplace_back(std::move(z));
-        return &mem_.back();
+    index_loaded();
+    // The shard stays locked until the point is in the index, so no other thread can make it too
+    shard &s = shard_for(z);
+    auto lock = maybe_lock(s.lock_);
+    auto u = s.index_.find(z);
+    if( u != s.index_.end() ) {
+        incf(u->second);
+        return u->second;
+    }
+    pathpoint p;
+    {
+        auto grow = maybe_lock(*grow_);
+        pointid_t const next = mem_.size();
+        if(next == std::numeric_limits<pointid_t>::max())
+            throw std::out_of_range("too many points for the point index type");
+        xs_.push_back(z.x());
+        ys_.push_back(z.y());
+        counts_.emplace_back(1u);
+        p = &mem_.emplace_back(z, next);
+    }
+    s.index_.emplace(z, p);
+    return p;
+}
+
+
+void pntalloc::load(std::span<std::int64_t const> xs, std::span<std::int64_t const> ys)
+{
+    if(concurrent_ || mem_.size() != 0)
+        throw std::logic_error("Points can only be loaded into an empty point factory which is not concurrent");
+    if(xs.size() != ys.size())
+        throw BadPoint("load needs as many y coordinates as x coordinates");
+    auto const n = xs.size();
+    if(n >= std::numeric_limits<pointid_t>::max())
+        throw std::out_of_range("too many points for the point index type");
+    constexpr auto lo = std::numeric_limits<point::coord_t>::min(), hi = std::numeric_limits<point::coord_t>::max();
+    xs_.reserve(n);
+    ys_.reserve(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        if(xs[i] < lo || xs[i] > hi || ys[i] < lo || ys[i] > hi)
+            throw BadPoint("Loaded coordinates do not fit in a point", {i});
+        point const z(static_cast<point::coord_t>(xs[i]), static_cast<point::coord_t>(ys[i]));
+        xs_.push_back(z.x());
+        ys_.push_back(z.y());
+        counts_.emplace_back(0u);
+        mem_.emplace_back(z, static_cast<pointid_t>(i));
+    }
+    unindexed_ = n;
+}
+
+
+void pntalloc::index_loaded_points() const
+{
+    auto const n = std::exchange(unindexed_, 0);
+    for(std::size_t k = 0; k < nshards_; ++k)
+        shards_[k].index_.reserve(n / nshards_ + 1);
+    for(std::size_t i = 0; i < n; ++i) {
+        // The points belong to this factory, like those it hands out from make_point
+        auto const p = const_cast<pathpoint>(&mem_[i]);
+        if(!shard_for(*p).index_.emplace(*p, p).second) {
+            std::ostringstream msg;
+            msg << "Loaded point " << *p << " is not distinct";
+            throw BadPoint(msg.str(), {i});
+        }
+    }
+}
+
+
+pathpoint pntalloc::make_scaled(double u, double v)
+{
+    if(!snaps_exactly(std::round(u)) || !snaps_exactly(std::round(v))) {
+        std::ostringstream msg;
+        msg << "Coordinates " << u << ',' << v << " (in grid units of " << tol_ << ") lose precision when snapped";
+        throw BadPoint(msg.str());
+    }
+    return make_snapped(u, v);
+}
+
+
+pathpoint pntalloc::make_snapped(double u, double v)
+{
+    auto const rounded = point(static_cast<point::coord_t>(std::round(u)), static_cast<point::coord_t>(std::round(v)));
+    if(snap_ == snap_type_t::SNAP_GRID)
+        return make_point(rounded);
+    /* Euclidean snapping: in grid units, tol is 1, so any point within tol lies in
+     * the 3x3 block of grid cells around (u,v).  The index is the spatial hash,
+     * so each cell is a single lookup.
+     */
+    auto lock = maybe_lock(*near_);
+    auto const i0 = static_cast<point::coord_t>(std::ceil(u-1.0)), i1 = static_cast<point::coord_t>(std::floor(u+1.0));
+    auto const j0 = static_cast<point::coord_t>(std::ceil(v-1.0)), j1 = static_cast<point::coord_t>(std::floor(v+1.0));
+    std::optional<point> best;
+    double bestd2 = 1.0;
+    for(auto i = i0; i <= i1; ++i)
+        for(auto j = j0; j <= j1; ++j) {
+            double const d2 = (i-u)*(i-u) + (j-v)*(j-v);
+            // Only look in cells that could hold a nearer point than the best so far
+            if((best ? d2 < bestd2 : d2 <= bestd2) && lookup(point(i,j)) != -1) {
+                best = point(i,j);
+                bestd2 = d2;
+            }
+        }
+    return make_point(best.value_or(rounded));
+}
+
+
+std::vector<pathpoint> pntalloc::make_scaled(std::span<double const> us, std::span<double const> vs)
+{
+    auto const n = us.size();
+    // Check the whole batch first: a plain loop over the columns without branches, so it vectorises
+    bool ok = true;
+    for(std::size_t i = 0; i < n; ++i)
+        ok &= snaps_exactly(std::round(us[i])) & snaps_exactly(std::round(vs[i]));
+    if(!ok) {
+        // Slow path, only to report the offenders
+        std::vector<std::size_t> where;
+        for(std::size_t i = 0; i < n; ++i)
+            if(!snaps_exactly(std::round(us[i])) || !snaps_exactly(std::round(vs[i])))
+                where.push_back(i);
+        std::ostringstream msg;
+        msg << where.size() << " coordinate pair(s) lose precision when snapped to grid " << tol_
+            << ", the first at index " << where.front();
+        throw BadPoint(msg.str(), std::move(where));
+    }
+    // Deduplicate against the existing points and within the batch in a single pass
+    for(std::size_t k = 0; k < nshards_; ++k) {
+        auto lock = maybe_lock(shards_[k].lock_);
+        shards_[k].index_.reserve(shards_[k].index_.size() + n/nshards_);
+    }
+    {
+        auto grow = maybe_lock(*grow_);
+        xs_.reserve(xs_.size() + n);
+        ys_.reserve(ys_.size() + n);
     }
-    mem_[u].incf();
-    return &mem_[u];
+    std::vector<pathpoint> result;
+    result.reserve(n);
+    for(std::size_t i = 0; i < n; ++i)
+        result.push_back(make_snapped(us[i], vs[i]));
+    return result;
 }
@@ -6,30 +6,161 @@
 #ifndef VEC2POLY_PNTALLOC_H
 #define VEC2POLY_PNTALLOC_H
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <ranges>
+#include <span>
+#include <stdexcept>
 #include <vector>
+#include <unordered_map>
 #include <concepts>
 #include "point.h"
 #include "lineseg.h"
+#include "arena.h"
 
 class world;
 
+
+/** Thrown when coordinates cannot be snapped to the grid without losing precision */
+class BadPoint : public Vec2PolyException {
+    /** Index of each offending coordinate pair in the input */
+    std::vector<std::size_t> where_;
+public:
+    BadPoint(std::string &&msg, std::vector<std::size_t> where = {}) : Vec2PolyException(std::move(msg)), where_(std::move(where)) {}
+    [[nodiscard]] std::vector<std::size_t> const &where() const noexcept { return where_; }
+};
+
+
+/** Snapping policies, chosen at compile time by pntalloc::snap_point and pntalloc::make_points.
+ *
+ * A policy's scale() converts an input coordinate into grid units (before rounding),
+ * given the reciprocal of the point factory's tolerance, so no policy needs to divide.
+ */
+
+/** Snap to the point factory's grid, whose size is only known at run time (the default) */
+struct snap_grid {
+    static constexpr double scale(double x, double inv_tol) noexcept { return x * inv_tol; }
+};
+
+/** Coordinates are already in grid units, and are only rounded */
+struct snap_none {
+    static constexpr double scale(double x, double) noexcept { return x; }
+};
+
+/** Snap to a grid of CELLS cells per unit, fixed at compile time.
+ * This is the same as snap_grid for a point factory whose tolerance is 1/CELLS */
+template<unsigned long CELLS>
+struct snap_fixed {
+    static constexpr double cells = static_cast<double>(CELLS);
+    static constexpr double scale(double x, double) noexcept { return x * cells; }
+};
+
+
 class pntalloc {
+public:
+    /** How unsnapped coordinates are turned into points.
+     * SNAP_GRID rounds to the nearest grid point;
+     * SNAP_EUCLID reuses any existing point within tol, else rounds as SNAP_GRID.
+     * Points with coordinates already on the grid are never snapped. */
+    enum class snap_type_t { SNAP_GRID, SNAP_EUCLID };
 private:
-    std::vector<xpathpoint> mem_;
+    /** Point storage; points never move once created, as pathpoints refer to them */
+    arena<xpathpoint> mem_;
+    /** Structure-of-arrays copy of the coordinates, indexed by point id.
+     * Points never change their coordinates, so these just grow along with mem_ */
+    std::vector<point::coord_t> xs_, ys_;
+    /** Use counts indexed by point id */
+    arena<unsigned> counts_;
+    /** One shard of the index of points keyed on their snapped coordinates.
+     * Points are spread over the shards by hash, and in concurrent mode
+     * each shard is locked separately */
+    struct shard {
+        std::mutex lock_;
+        std::unordered_map<point, pathpoint> index_;
+    };
+    std::unique_ptr<shard[]> shards_;
+    std::size_t nshards_;
+    /** In concurrent mode, serialises growing the point store */
+    std::unique_ptr<std::mutex> grow_;
+    /** In concurrent mode, serialises Euclidean snapping, which looks in several shards */
+    std::unique_ptr<std::mutex> near_;
+    /** Whether points may be made from several threads at once */
+    bool concurrent_;
+    snap_type_t snap_;
     /** tolerance for snapping points to grid */
     double tol_;
+    /** and its reciprocal, for the snapping policies */
+    double inv_tol_;
+    /** Number of points at the start of the store which were loaded (see load) and are not yet in the index */
+    mutable std::size_t unindexed_;
+
+    /** Number of index shards used in concurrent mode */
+    static constexpr std::size_t concurrent_shards = 64;
+
+    pntalloc(double tol, bool concurrent = false);
+
+    shard &shard_for(point p) const noexcept { return shards_[std::hash<point>{}(p) % nshards_]; }
+
+    /** Make a point at or near already scaled (but not rounded) coordinates */
+    pathpoint make_snapped(double u, double v);
+    /** Check scaled coordinates can be rounded without loss of precision, then make_snapped */
+    pathpoint make_scaled(double u, double v);
+    std::vector<pathpoint> make_scaled(std::span<double const> us, std::span<double const> vs);
 
-    pntalloc(double tol) noexcept;
+    /** Put the loaded points in the index, the first time it is used after loading.
+     * Throws BadPoint if two of them are the same */
+    void index_loaded() const
+    {
+        if(unindexed_ > 0)
+            index_loaded_points();
+    }
+    void index_loaded_points() const;
+
+    /** Lock m, but only in concurrent mode */
+    std::unique_lock<std::mutex> maybe_lock(std::mutex &m) const
+    {
+        return concurrent_ ? std::unique_lock(m) : std::unique_lock(m, std::defer_lock);
+    }
 public:
     pathpoint make_point(point z);
 
-    pathpoint make_point(double x, double y)
+    /** Make a point from unsnapped coordinates, scaled to the grid by the SNAP policy
+     * Throws BadPoint if either coordinate loses precision when snapped */
+    template<typename SNAP>
+    pathpoint snap_point(double x, double y)
+    {
+        return make_scaled(SNAP::scale(x, inv_tol_), SNAP::scale(y, inv_tol_));
+    }
+
+    /** Make a point from unsnapped coordinates
+     * Throws BadPoint if either coordinate loses precision when snapped */
+    pathpoint make_point(double x, double y) { return snap_point<snap_grid>(x, y); }
+
+    /** Make a batch of points from unsnapped coordinates, one per (x,y) pair.
+     *
+     * The whole batch is snapped to the grid before any point is made,
+     * so nothing is added if any coordinate loses precision.
+     *
+     * @tparam SNAP snapping policy
+     * @param xs x coordinates
+     * @param ys y coordinates, as many as xs
+     * @return the points, in input order
+     * Throws BadPoint listing every offending pair if any coordinate loses precision
+     */
+    template<typename SNAP = snap_grid>
+    std::vector<pathpoint> make_points(std::span<double const> xs, std::span<double const> ys)
     {
-	// XXX check for loss of precision
-        point q(std::round(x/tol_),std::round(y/tol_));
-        return make_point(q);
+        if(xs.size() != ys.size())
+            throw BadPoint("make_points needs as many y coordinates as x coordinates");
+        auto const n = xs.size();
+        // Scale the whole batch first: a plain loop over the columns, so it vectorises
+        std::vector<double> us(n), vs(n);
+        for(std::size_t i = 0; i < n; ++i) {
+            us[i] = SNAP::scale(xs[i], inv_tol_);
+            vs[i] = SNAP::scale(ys[i], inv_tol_);
+        }
+        return make_scaled(us, vs);
     }
 
     template<typename A, typename B>
@@ -39,19 +170,67 @@ public:
          return make_point(static_cast<double>(x), static_cast<double>(y));
     }
 
+    /** Add points at coordinates on the grid, in id order, each with no uses yet.
+     * This restores points known to be distinct (see world::world(snapshot const &)) in one pass
+     * over the columns: they are only put in the index when it is first used, by make_point or lookup,
+     * which then throw BadPoint if two of them are the same.
+     * Throws std::logic_error unless the factory is empty and not concurrent,
+     * or BadPoint if a coordinate does not fit in a point */
+    void load(std::span<std::int64_t const> xs, std::span<std::int64_t const> ys);
+
     std::ranges::view auto points() noexcept
     {
-        return std::ranges::views::all(mem_) | std::views::transform([](auto &x) { return &x;});
+        return std::views::iota(std::size_t{0}, mem_.size())
+            | std::views::transform([this](std::size_t i) -> pathpoint { return &mem_[i]; });
     }
 
-    /** Look up a base point to see if it is a point */
-    ssize_t lookup(point bp)
+    /** Look up a base point to see if it is a point
+     * @return index into the point store, or -1 if not found (O(1) expected)
+     */
+    ssize_t lookup(point bp) const
     {
-        auto y = std::ranges::find(mem_, bp);
-        if(y == mem_.cend())
+        index_loaded();
+        shard &s = shard_for(bp);
+        auto lock = maybe_lock(s.lock_);
+        auto y = s.index_.find(bp);
+        if(y == s.index_.cend())
             return -1;
-        return y-mem_.cbegin();
+        return static_cast<ssize_t>(y->second->id());
+    }
+
+    /** Select how points are snapped from now on */
+    void snapping(snap_type_t snap) noexcept { snap_ = snap; }
+    [[nodiscard]] snap_type_t snapping() const noexcept { return snap_; }
+
+    /** Are points made from several threads (see world::world)? */
+    [[nodiscard]] bool concurrent() const noexcept { return concurrent_; }
+
+    /** Look up a point by its index (see xpathpoint::id) */
+    [[nodiscard]] pathpoint at(pointid_t id) noexcept { return &mem_[id]; }
+
+    /** x coordinates of all points, indexed by point id */
+    [[nodiscard]] std::span<point::coord_t const> xs() const noexcept { return xs_; }
+    /** y coordinates of all points, indexed by point id */
+    [[nodiscard]] std::span<point::coord_t const> ys() const noexcept { return ys_; }
+    /** Number of line segment ends at a point made by this factory */
+    [[nodiscard]] unsigned use_count(pathpoint p) const noexcept { return counts_[p->id()]; }
+    /** Use counts are updated atomically as points can be shared between threads */
+    void incf(pathpoint p) noexcept { std::atomic_ref<unsigned>(counts_[p->id()]).fetch_add(1, std::memory_order_relaxed); }
+    /** Throws std::out_of_range if the count is already zero, leaving it at zero */
+    void decf(pathpoint p)
+    {
+        std::atomic_ref<unsigned> count(counts_[p->id()]);
+        unsigned c = count.load(std::memory_order_relaxed);
+        do {
+            if(c == 0)
+                throw std::out_of_range("decr use count below zero");
+        } while(!count.compare_exchange_weak(c, c-1, std::memory_order_relaxed));
     }
+    /** Use counts of all points in id order, as a sequence of contiguous spans */
+    [[nodiscard]] auto use_counts() const { return counts_.chunks(); }
+
+    /** Number of distinct points */
+    [[nodiscard]] std::size_t size() const noexcept { return mem_.size(); }
 
     lineseg make_lineseg(pathpoint a, point b)
     {
@@ -73,10 +252,13 @@ public:
 
     double tol() const noexcept { return tol_; }
 
-    // only world can create us
+    // only world can create us (and use our locks)
     friend class world;
     // and the unit tests
     friend bool test_pntalloc();
+    friend bool test_pntalloc_grow();
+    friend bool test_make_points();
+    friend bool test_snap_euclid();
     friend bool test_lineseg();
     friend bool test_split_seg();
     friend bool test_interior1();
@@ -17,7 +17,8 @@ operator<<(std::ostream &os, point const &p)
 std::ostream &
 operator<<(std::ostream &os, pathpoint p)
 {
-    os << '(' << p->x() << ',' << p->y() << ")[" << p->use_count_ << "]";
+    // The use count is kept by the point factory, so the point is shown with its id
+    os << '(' << p->x() << ',' << p->y() << ")#" << p->id();
     return os;
 }
 
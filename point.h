@@ -6,6 +6,9 @@
 #define VEC2POLY_POINT_H
 
 #include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <memory>
 // vector is only needed for the ostream of vectors of points
@@ -39,17 +42,46 @@ inline bool between(NUM a, NUM x, NUM b) noexcept
 class pntalloc;
 
 
-/** point is a POD class holding the basic version of point */
-class point {
+/** pointid_t is the index of a point in the point factory (pntalloc).
+ * With VEC2POLY_COMPACT_INDICES defined it is 32 bits wide, as are node_t and edge_t
+ * (see polygon.h).  This limits the world to 2^32-1 points and paths,
+ * but halves the size of everything indexed by them.
+ */
+#ifdef VEC2POLY_COMPACT_INDICES
+typedef std::uint32_t pointid_t;
+#else
+typedef std::size_t pointid_t;
+#endif
+
+
+/** coord_t is the type of a coordinate after snapping to the grid.
+ * With VEC2POLY_COORD32 defined it is 32 bits wide, which is enough for most maps
+ * and halves the memory (and bandwidth) needed for coordinates.
+ */
+#ifdef VEC2POLY_COORD32
+typedef std::int32_t coord_t;
+#else
+typedef std::int64_t coord_t;
+#endif
+
+
+/** basic_point is a POD class holding the basic version of point
+ * @tparam COORD signed integer coordinate type
+ */
+template<std::signed_integral COORD>
+class basic_point {
+public:
+    /** Type of a coordinate (after snapping to the grid) */
+    using coord_t = COORD;
 private:
     /** x and y coordinates of point */
-    signed long x_, y_;
+    coord_t x_, y_;
 public:
-    constexpr point(signed long x, signed long y): x_(x), y_(y) {}
+    constexpr basic_point(coord_t x, coord_t y): x_(x), y_(y) {}
 
-    constexpr bool operator==(point const &other) const noexcept = default;
-    constexpr bool operator!=(point const &other) const noexcept = default;
-    constexpr bool operator<(point const &other) const noexcept
+    constexpr bool operator==(basic_point const &other) const noexcept = default;
+    constexpr bool operator!=(basic_point const &other) const noexcept = default;
+    constexpr bool operator<(basic_point const &other) const noexcept
     {
         if(*this == other) return false;
         if(x_ < other.x_) {
@@ -65,6 +97,25 @@ public:
 };
 
 
+/** The point type used throughout, with the configured coordinate type */
+using point = basic_point<coord_t>;
+
+
+/** Hash for points so they can key unordered containers.
+ * Coordinates are already snapped to the grid, so equal points hash equally */
+template<typename COORD>
+struct std::hash<basic_point<COORD>>
+{
+    std::size_t operator()(basic_point<COORD> const &p) const noexcept
+    {
+        // Fibonacci hashing of x, mixed with y (boost::hash_combine style)
+        auto h = static_cast<std::size_t>(p.x()) * 0x9e3779b97f4a7c15ULL;
+        h ^= static_cast<std::size_t>(p.y()) + 0x9e3779b9ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+
 std::ostream &operator<<(std::ostream &, point const &);
 
 std::ostream &operator<<(std::ostream &, std::vector<point> const &);
@@ -78,20 +129,19 @@ using pathpoint = xpathpoint *;
 /** pathpoint is the point inside of a path */
 class xpathpoint : public point
 {
-    unsigned use_count_;
+    /** Index of the point in the point factory that made it, which also keeps its use count
+     * (see pntalloc::use_count) */
+    pointid_t id_;
 public:
-    xpathpoint(double x, double y) : point(x, y), use_count_(1) {}
-    xpathpoint(point bp) : point(bp), use_count_(1) {}
+    xpathpoint(point bp, pointid_t id) : point(bp), id_(id) {}
     xpathpoint(xpathpoint const &) = default;
     xpathpoint(xpathpoint &&) = default;
     xpathpoint &operator=(xpathpoint &o) = default;
     xpathpoint &operator=(xpathpoint &&) = default;
     ~xpathpoint() {}
 
-    [[nodiscard]] auto use_count() const noexcept { return use_count_; }
-
-    void incf() noexcept { ++use_count_; }
-    void decf() { if(!(use_count_--)) throw std::out_of_range("decr use count below zero"); }
+    /** Index of this point, stable for the lifetime of the point factory */
+    [[nodiscard]] pointid_t id() const noexcept { return id_; }
 
     bool equals(point o)
     {
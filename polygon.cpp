@@ -100,14 +100,20 @@ void polygon::tidy(world const &w, graph const &g)
  */
 bool polygon::interior(const world &w, point p) const
 {
-    path_lookup lookup(w);
-    // This will go through all line segments in arbitrary order but that is OK for this purpose
-    auto const seqs = edges_
-            | std::views::transform(lookup)
-            | std::views::join
-            | std::views::transform([p](lineseg const &s) { return intersects(s,p); });
-    // Neither reduce nor accumulate is available in constrained form
-    auto const score = std::reduce(std::begin(seqs), std::end(seqs), 0u);
+    return interior(w, p, edge_set());
+}
+
+
+bool polygon::interior(const world &w, point p, std::vector<edge_t> const &on) const
+{
+    // The world's spatial index finds the segments the ray may hit, on any path,
+    // so only those of the polygon's own paths count
+    unsigned score = 0;
+    w.segments_right_of(p, [&on,&score,p](std::size_t e, lineseg const &s)
+    {
+        if(std::ranges::binary_search(on, e))
+            score += intersects(s, p);
+    });
     // Remember, double the score is returned, and p is interior if the score is odd
     if(score & 1u)
         throw BadPath("interior double score uneven");  // can't happen?
@@ -116,6 +122,31 @@ bool polygon::interior(const world &w, point p) const
 }
 
 
+std::vector<edge_t> polygon::edge_set() const
+{
+    std::vector<edge_t> on;
+    // Nodes not (yet) reached have no edge
+    for(std::size_t i = 0; i < edges_.size(); ++i)
+        if(come_from_[i] != invalid_)
+            on.push_back(edges_[i]);
+    std::ranges::sort(on);
+    auto const dups = std::ranges::unique(on);
+    on.erase(dups.begin(), dups.end());
+    return on;
+}
+
+
+segbox polygon::bounds(world const &w, std::vector<edge_t> const &on) const
+{
+    path_lookup lookup(w);
+    segbox box(*lookup(on.front()).begin(), 0);
+    for( edge_t e : on )
+        for( lineseg const &s : lookup(e) )
+            box.cover(segbox(s, 0));
+    return box;
+}
+
+
 void polygon::replace_paths(world const &w, std::vector<edge_t> &paths, edge_t keep)
 {
 }
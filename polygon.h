@@ -5,6 +5,7 @@
 #ifndef VEC2POLY_POLYGON_H
 #define VEC2POLY_POLYGON_H
 
+#include <cstdint>
 #include <iosfwd>
 #include "point.h"
 #include "except.h"
@@ -19,13 +20,21 @@ class world;
  * In addition to (reverse) lookup in graphimpl.vertex_, they will
  * also be the end points of the paths (edges).
  */
+#ifdef VEC2POLY_COMPACT_INDICES
+typedef std::uint32_t node_t;
+#else
 typedef unsigned long node_t;
+#endif
 
 /** edge_t is the edge index as maintained by the world object.
  * After proper_paths() is run (deriving paths between branch points),
  * the edges remain fixed in world.map_
  */
+#ifdef VEC2POLY_COMPACT_INDICES
+typedef std::uint32_t edge_t;
+#else
 typedef unsigned long edge_t;
+#endif
 
 
 /** Polygon diagnostics returned by is_valid */
@@ -114,6 +123,13 @@ class polygon {
      * */
     void replace_paths(world const &w, std::vector<edge_t> &paths, edge_t keep);
 
+    /** Edge numbers of the paths making up the polygon, sorted, without duplicates */
+    [[nodiscard]] std::vector<edge_t> edge_set() const;
+    /** Bounding box of the given paths (as returned by edge_set) */
+    [[nodiscard]] segbox bounds(world const &w, std::vector<edge_t> const &on) const;
+    /** interior() for the polygon made of the given paths (as returned by edge_set) */
+    [[nodiscard]] bool interior(const world &w, point p, std::vector<edge_t> const &on) const;
+
 public:
     /** Create a polygon of N vertices.
      * @param N number of vertices or equivalently number of edges
@@ -188,7 +204,7 @@ public:
      * Interior paths are candidates from removal from a polygon.
      * This implementation needs to be here so the compiler can pick up the return type
      */
-    auto interior_paths(world const &w)
+    auto interior_paths(world const &w) const
     {
         /** All paths are
          *  1. On the polygon
@@ -197,17 +213,21 @@ public:
          * We now need to connect paths inside the polygon and use them to
          * reduce the polygon
          */
-         edge_t index{0};
-
-         // Without an indexed iterator (it's in C++23) we have to do it ourselves
-         // - tracking the index we identify paths on the polygon
-         auto is_interior = [this,&w,&index](path const &path) -> bool
-         {
-             auto p = this->edges_.cbegin(), q = this->edges_.cend();
-             // path index is not on the polygon list (meaning path is not on polygon)
-             // and a path test point is interior to the polygon
-             return std::find(p,q,index++) == q && this->interior(w, path.testpoint());
-         };
+        auto on = edge_set();
+        // Only paths with a segment in the polygon's bounding box can be inside it;
+        // the world's spatial index finds them without visiting every path
+        std::vector<bool> near(w.map().size(), false);
+        if(!on.empty())
+            w.segments_near(bounds(w, on), [&near](std::size_t e, lineseg const &) { near[e] = true; });
+
+        // The path index is its position in the world's paths (as in an indexed view)
+        auto is_interior = [this,&w,on=std::move(on),near=std::move(near)](path const &path) -> bool
+        {
+            edge_t const index = &path - w.map().data();
+            // path index is not on the polygon list (meaning path is not on polygon)
+            // and a path test point is interior to the polygon
+            return near[index] && !std::ranges::binary_search(on, index) && this->interior(w, path.testpoint(), on);
+        };
 
         return w.paths()
                 | std::views::filter(is_interior);
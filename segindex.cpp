@@ -0,0 +1,55 @@
+//
+// Created by jens on 17/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include "segindex.h"
+
+
+void segindex::pack(std::vector<segbox> &&leaves)
+{
+    nodes_.clear();
+    level_.clear();
+    if(leaves.empty())
+        return;
+    auto const n = leaves.size();
+    // Sort-tile-recursive: cut the boxes into vertical slices by x, then sort each slice by y,
+    // so consecutive runs of fanout boxes (the leaves of one parent) are close together
+    auto const xmid = [](segbox const &b) { return b.xlo + b.xhi; };
+    auto const ymid = [](segbox const &b) { return b.ylo + b.yhi; };
+    std::ranges::sort(leaves, {}, xmid);
+    auto const parents = (n + fanout - 1) / fanout;
+    auto const slice = fanout * static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(parents))));
+    for( std::size_t s = 0; s < n; s += slice ) {
+        auto const first = leaves.begin() + static_cast<std::ptrdiff_t>(s);
+        std::sort(first, first + static_cast<std::ptrdiff_t>(std::min(slice, n-s)),
+                  [&ymid](segbox const &a, segbox const &b) { return ymid(a) < ymid(b); });
+    }
+    nodes_ = std::move(leaves);
+    level_.push_back(0);
+    // Each further level has one parent for every fanout consecutive nodes of the level below
+    std::size_t lo = 0, hi = n;
+    do {
+        level_.push_back(hi);
+        for( std::size_t c = lo; c < hi; c += fanout ) {
+            segbox parent{nodes_[c].xlo, nodes_[c].xhi, nodes_[c].ylo, nodes_[c].yhi, c};
+            for( auto d = c+1; d < std::min(c+fanout, hi); ++d )
+                parent.cover(nodes_[d]);
+            nodes_.push_back(parent);
+        }
+        lo = hi;
+        hi = nodes_.size();
+    } while(hi - lo > 1);
+    level_.push_back(hi);
+}
+
+
+void segindex::repack()
+{
+    auto const packed = level_.empty() ? 0 : level_[1];
+    std::vector<segbox> leaves(nodes_.begin(), nodes_.begin() + static_cast<std::ptrdiff_t>(packed));
+    leaves.insert(leaves.end(), tail_.begin(), tail_.end());
+    tail_.clear();
+    pack(std::move(leaves));
+}
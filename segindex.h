@@ -0,0 +1,107 @@
+//
+// Spatial index of line segments
+// Created by jens on 17/10/26.
+//
+
+#ifndef VEC2POLY_SEGINDEX_H
+#define VEC2POLY_SEGINDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "point.h"
+#include "intersect.h"
+
+
+/** Packed R-tree over the bounding boxes of line segments.
+ *
+ * The tree is bulk loaded (sort-tile-recursive) from all the boxes at once,
+ * and is then read-only apart from an unsorted tail of boxes inserted since,
+ * which queries scan linearly.  Inserting is cheap, so the owner should
+ * repack() once the tail is large (see stale()), before querying again.  Boxes are never removed or updated: when a segment is split,
+ * both parts lie within the old box, so a stale box is merely conservative.
+ *
+ * Queries return the seg index of every box which may overlap the query,
+ * so callers still need an exact test on the segments themselves.
+ */
+class segindex {
+public:
+    /** Number of children per node */
+    static constexpr std::size_t fanout = 16;
+private:
+    /** All levels of the tree, leaves first, then each level of parents up to the root.
+     * In a leaf, seg is the caller's index of the segment; in a parent, it is
+     * the position in nodes_ of its first child */
+    std::vector<segbox> nodes_;
+    /** Position in nodes_ of the start of each level (and the end of the last) */
+    std::vector<std::size_t> level_;
+    /** Boxes inserted since the tree was packed */
+    std::vector<segbox> tail_;
+
+    void pack(std::vector<segbox> &&leaves);
+public:
+    segindex() noexcept : nodes_(), level_(), tail_() {}
+
+    /** Replace the contents of the index with the given boxes */
+    void build(std::vector<segbox> boxes) { tail_.clear(); pack(std::move(boxes)); }
+    /** Add a box to the index (to the tail, see stale) */
+    void insert(segbox const &box) { tail_.push_back(box); }
+    /** Is the tail so large, compared with the tree, that queries would be faster after repacking? */
+    [[nodiscard]] bool stale() const noexcept
+    {
+        return tail_.size() > std::max<std::size_t>(fanout, size() / 8);
+    }
+    /** Pack the tail into the tree */
+    void repack();
+    /** Empty the index */
+    void clear() noexcept { nodes_.clear(); level_.clear(); tail_.clear(); }
+
+    /** Number of boxes in the index */
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return (level_.empty() ? 0 : level_[1]) + tail_.size();
+    }
+    [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+
+    /** Call f(seg) for every box overlapping the query box, in no particular order */
+    template<typename F>
+    void query(segbox const &q, F &&f) const
+    {
+        for( segbox const &b : tail_ )
+            if(b.overlaps(q))
+                f(b.seg);
+        if(level_.empty())
+            return;
+        // Depth first from the root, with an explicit stack of (level, node position)
+        std::vector<std::pair<std::size_t,std::size_t>> todo{{level_.size()-2, level_[level_.size()-2]}};
+        while(!todo.empty()) {
+            auto const [k, n] = todo.back();
+            todo.pop_back();
+            segbox const &b = nodes_[n];
+            if(!b.overlaps(q))
+                continue;
+            if(k == 0) {
+                f(b.seg);
+                continue;
+            }
+            // Children of a node at level k are consecutive on level k-1, which ends where level k starts
+            auto const end = std::min(b.seg + fanout, level_[k]);
+            for( auto c = b.seg; c < end; ++c )
+                todo.emplace_back(k-1, c);
+        }
+    }
+
+    /** Call f(seg) for every box which may be hit by a ray going right from p
+     * (see intersects(lineseg const &, point)) */
+    template<typename F>
+    void ray(point p, F &&f) const
+    {
+        double const x = p.x(), y = p.y();
+        query(segbox(x, std::numeric_limits<double>::infinity(), y, y, 0), std::forward<F>(f));
+    }
+};
+
+
+#endif //VEC2POLY_SEGINDEX_H
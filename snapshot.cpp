@@ -0,0 +1,67 @@
+//
+// Created by jens on 17/10/26.
+//
+
+#include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+
+snapshot::snapshot(std::string const &filename) : base_(nullptr), size_(0)
+{
+    int const fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw BadSnapshot("Cannot open snapshot " + filename);
+    struct stat st{};
+    if(::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(snapshot_header)) {
+        ::close(fd);
+        throw BadSnapshot("Snapshot " + filename + " is too short");
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    void *base = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file open
+    ::close(fd);
+    if(base == MAP_FAILED)
+        throw BadSnapshot("Cannot map snapshot " + filename);
+    base_ = base;
+
+    auto const &h = header();
+    auto fail = [this, &filename](char const *why)
+    {
+        ::munmap(base_, size_);
+        throw BadSnapshot("Snapshot " + filename + ": " + why);
+    };
+    if(std::memcmp(h.magic, "vec2poly", sizeof(h.magic)) != 0)
+        fail("not a snapshot");
+    if(h.order != 1)
+        fail("written with another byte order");
+    if(h.version != version)
+        fail("unknown version");
+    // Every array must lie within the file, and be aligned for its type
+    auto fits = [this](std::uint64_t offset, std::uint64_t n, std::size_t size, std::size_t align)
+    {
+        return offset % align == 0 && offset <= size_ && n <= (size_ - offset) / size;
+    };
+    // (paths + 1 path starts, so paths must be checked before adding one)
+    if(!fits(h.xs, h.points, 8, 8) || !fits(h.ys, h.points, 8, 8) || !fits(h.branch, h.points, 1, 1)
+       || h.paths >= std::numeric_limits<std::uint64_t>::max() || !fits(h.starts, h.paths + 1, 8, 8)
+       || !fits(h.ids, h.vertices, 8, 8) || h.split > h.paths)
+        fail("cut short");
+    // Paths must lie within the vertices, in order
+    auto const starts = array<std::uint64_t>(h.starts, h.paths + 1);
+    if(starts[0] != 0 || starts[h.paths] != h.vertices)
+        fail("bad paths");
+    for(std::size_t k = 0; k < h.paths; ++k)
+        if(starts[k+1] < starts[k] || starts[k+1] - starts[k] < 2)
+            fail("bad paths");
+}
+
+
+snapshot::~snapshot()
+{
+    ::munmap(base_, size_);
+}
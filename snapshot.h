@@ -0,0 +1,100 @@
+//
+// Binary snapshot of a world which has been split into proper paths
+// Created by jens on 17/10/26.
+//
+
+#ifndef VEC2POLY_SNAPSHOT_H
+#define VEC2POLY_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include "except.h"
+
+
+struct BadSnapshot : public Vec2PolyException
+{
+public:
+    BadSnapshot() noexcept : Vec2PolyException("Bad snapshot") {};
+    template<typename PARAM>
+    BadSnapshot(PARAM &&msg) noexcept : Vec2PolyException(std::forward<PARAM>(msg)) {}
+};
+
+
+/** Header at the start of a snapshot file.
+ *
+ * The header is followed by flat arrays, each starting at a multiple of 8 bytes
+ * from the start of the file, at the offsets given in the header, so the file
+ * can be mapped at any address and used in place:
+ *   - x and y coordinates of each point, in grid units, indexed by point id (int64);
+ *   - whether each point is a branch point, indexed by point id (one byte each);
+ *   - where the points of each path start in the array of vertices, and where the last ends (uint64);
+ *   - the vertices of all paths, as point ids (uint64).
+ * Numbers are in the byte order of the machine that wrote the file, which is checked on reading.
+ */
+struct snapshot_header {
+    /** "vec2poly" */
+    char magic[8];
+    /** Format version (see snapshot::version) */
+    std::uint32_t version;
+    /** Always 1, to check the byte order */
+    std::uint32_t order;
+    /** Grid size of the world */
+    double tol;
+    std::uint64_t points, paths, vertices;
+    /** Number of leading paths which had been split (see world::split_segments) */
+    std::uint64_t split;
+    /** Offsets of the arrays from the start of the file */
+    std::uint64_t xs, ys, branch, starts, ids;
+};
+
+
+/** A snapshot file, mapped read only into memory.
+ *
+ * Loading a snapshot into a world (see world::world(snapshot const &)) restores it as it was
+ * when it was written by world::write_snapshot, typically after split_segments and proper_paths,
+ * so those need not be run again.  Mapping the file only checks the header and where
+ * paths start; the arrays are paged in as they are used.
+ */
+class snapshot {
+    void *base_;
+    std::size_t size_;
+
+    [[nodiscard]] snapshot_header const &header() const noexcept { return *static_cast<snapshot_header const *>(base_); }
+    template<typename T>
+    [[nodiscard]] std::span<T const> array(std::uint64_t offset, std::uint64_t n) const noexcept
+    {
+        return {reinterpret_cast<T const *>(static_cast<std::byte const *>(base_) + offset), static_cast<std::size_t>(n)};
+    }
+public:
+    static constexpr std::uint32_t version = 1;
+
+    /** Map the snapshot file.
+     * Throws BadSnapshot if the file cannot be mapped, or is not a snapshot, or is cut short */
+    explicit snapshot(std::string const &filename);
+    snapshot(snapshot const &) = delete;
+    snapshot &operator=(snapshot const &) = delete;
+    ~snapshot();
+
+    [[nodiscard]] double tol() const noexcept { return header().tol; }
+    [[nodiscard]] std::size_t points() const noexcept { return header().points; }
+    [[nodiscard]] std::size_t paths() const noexcept { return header().paths; }
+    [[nodiscard]] std::size_t split() const noexcept { return header().split; }
+
+    /** Coordinates of the points, indexed by point id */
+    [[nodiscard]] std::span<std::int64_t const> xs() const noexcept { return array<std::int64_t>(header().xs, header().points); }
+    [[nodiscard]] std::span<std::int64_t const> ys() const noexcept { return array<std::int64_t>(header().ys, header().points); }
+    /** Branch point flags, indexed by point id */
+    [[nodiscard]] std::span<std::uint8_t const> branch() const noexcept { return array<std::uint8_t>(header().branch, header().points); }
+    /** Point ids of path k, in order.
+     * The ids are not checked (see world::world(snapshot const &)) */
+    [[nodiscard]] std::span<std::uint64_t const> path(std::size_t k) const noexcept
+    {
+        auto const starts = array<std::uint64_t>(header().starts, header().paths + 1);
+        return array<std::uint64_t>(header().ids + starts[k] * sizeof(std::uint64_t), starts[k+1] - starts[k]);
+    }
+};
+
+
+#endif //VEC2POLY_SNAPSHOT_H
@@ -4,11 +4,18 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <array>
+#include <list>
 #include <map>
+#include <set>
 #include <functional>
 #include <ranges>
 #include <algorithm>
+#include <thread>
+#include <random>
+#include <filesystem>
+#include <unistd.h>
 #include "lineseg.h"
 #include "world.h"
 #include "pntalloc.h"
@@ -16,7 +23,10 @@
 #include "polygon.h"
 #include "perf.h"
 #include "toplevel.h"
+#include "tiled.h"
+#include "snapshot.h"
 #include "iobase.h"
+#include "alloc-count.h"
 
 bool expect(pntalloc &, int i, lineseg const &, lineseg const &, std::optional<point>);
 
@@ -24,20 +34,52 @@ bool expect(pntalloc &, int i, lineseg const &, lineseg const &, std::optional<p
 
 /** Test basic pathpoint allocator */
 [[nodiscard]] bool test_pntalloc();
+/** Test pathpoints stay put as the allocator grows */
+[[nodiscard]] bool test_pntalloc_grow();
+/** Test making points in bulk */
+[[nodiscard]] bool test_make_points();
+/** Test snapping to nearby points */
+[[nodiscard]] bool test_snap_euclid();
+/** Test adding paths from several threads */
+[[nodiscard]] static bool test_concurrent_import();
+/** Test the spatial index of line segments */
+[[nodiscard]] static bool test_segindex();
 /** Test line segments and their intersections */
 [[nodiscard]] bool test_lineseg();
+/** Test batches of intersection tests agree with testing one pair at a time */
+[[nodiscard]] static bool test_batch_intersects();
+/** Test the Bentley-Ottmann sweep finds the same crossings as the brute force search */
+[[nodiscard]] static bool test_sweep_intersections();
 /** Test splitting line segment into two */
 [[nodiscard]] bool test_split_seg();
 /** Test inserter into path */
 [[nodiscard]] bool test_poly1();
 /** Test splitting paths at intersections */
 [[nodiscard]] bool test_poly2();
+/** Test the sweep line, interval sweep, spatial index, tiled and chain splits give the same world as the brute force one */
+[[nodiscard]] static bool test_split_sweep();
+/** Test crossings are not snapped onto nearby points */
+[[nodiscard]] static bool test_split_euclid();
 /** Test path iterator - which iterates over segments */
 [[nodiscard]] static bool test_path_iter();
 /** Test finding branch points (nodes of degree > 2) */
 [[nodiscard]] static bool test_branch_points();
 /** Test reorganising the path into "proper" paths starting and ending in branch points */
 [[nodiscard]] static bool test_path_split();
+/** Test making proper paths allocates per path, not per line segment */
+[[nodiscard]] static bool test_path_split_alloc();
+/** Test making proper paths gives the same paths whatever the number of threads */
+[[nodiscard]] static bool test_path_split_threads();
+/** Test making proper paths of a map one tile at a time */
+[[nodiscard]] static bool test_tiled_map();
+/** Test writing a world to a snapshot and restoring it */
+[[nodiscard]] static bool test_snapshot();
+/** Test simplifying paths */
+[[nodiscard]] static bool test_simplify();
+/** Test removing degenerate and duplicate line segments */
+[[nodiscard]] static bool test_clean();
+/** Test reordering points and paths along a Hilbert curve */
+[[nodiscard]] static bool test_hilbert_order();
 /** Testing the polygon edge iterator */
 [[nodiscard]] static bool test_make_poly1();
 /** Test finding a polygon in the world */
@@ -55,6 +97,7 @@ bool expect(pntalloc &, int i, lineseg const &, lineseg const &, std::optional<p
 
 static world make_world(int);
 
+
 /** Utility function for test code to access the World's paths */
 decltype(world::map_) &test_paths(world &w)
 {
@@ -74,8 +117,12 @@ int tests()
     bool ret = true;
     unsigned num{0};
     // Tests are to be run in this order
-    std::array<std::function<bool()>,15> all{test_pntalloc, test_lineseg, test_split_seg, test_poly1,
-                                            test_poly2, test_path_iter, test_branch_points, test_path_split,
+    std::array<std::function<bool()>,31> all{test_pntalloc, test_pntalloc_grow, test_make_points,
+                                            test_snap_euclid, test_concurrent_import, test_segindex, test_lineseg,
+                                            test_batch_intersects, test_sweep_intersections, test_split_seg, test_poly1,
+                                            test_poly2, test_split_sweep, test_split_euclid, test_path_iter, test_branch_points, test_path_split,
+                                            test_path_split_alloc, test_path_split_threads, test_tiled_map, test_snapshot,
+                                            test_simplify, test_clean, test_hilbert_order,
                                             test_make_poly1, test_make_poly2, test_interior, test_tidy_poly,
                                             test_bigworld, test_tidy_poly2, test_io_w};
     for( auto testfunc : all ) {
@@ -106,8 +153,228 @@ bool test_pntalloc()
     pathpoint u1 = z.make_point(1,2);
     pathpoint u2 = z.make_point(3,4);
     pathpoint u3 = z.make_point(1,2);
-    return u1 == u3 && u1->use_count() == 2 \
-        && u2->use_count() == 1 && u2 != u1;
+    // Snapped coordinates are looked up through the index
+    if(z.lookup(point(300,400)) != 1 || z.lookup(point(3,4)) != -1 || z.size() != 2
+       || z.at(u2->id()) != u2 || u2->id() != 1) {
+        std::cerr << "pntalloc lookup failed\n";
+        return false;
+    }
+    // ... and the same points as columns
+    if(z.xs()[1] != 300 || z.ys()[1] != 400 || (*z.use_counts().begin())[0] != 2) {
+        std::cerr << "pntalloc columns do not match points\n";
+        return false;
+    }
+    if(u1 != u3 || z.use_count(u1) != 2 || z.use_count(u2) != 1 || u2 == u1)
+        return false;
+    // A use count never goes below zero
+    z.decf(u2);
+    try {
+        z.decf(u2);
+        std::cerr << "pntalloc decremented a use count below zero\n";
+        return false;
+    }
+    catch(std::out_of_range const &) {
+    }
+    return z.use_count(u2) == 0;
+}
+
+
+bool test_pntalloc_grow()
+{
+    pntalloc z(1.0);
+    pathpoint first = z.make_point(0, 0);
+    // Enough points to need several chunks of storage
+    constexpr long N = 10000;
+    std::vector<pathpoint> pts;
+    for( long i = 1; i <= N; ++i )
+        pts.push_back(z.make_point(i, -i));
+    if(first != z.make_point(0, 0) || *first != point(0,0) || z.use_count(first) != 2) {
+        std::cerr << "pntalloc_grow first point moved: " << first << std::endl;
+        return false;
+    }
+    for( long i = 1; i <= N; ++i )
+        if(*pts[i-1] != point(i, -i) || z.lookup(point(i, -i)) != i) {
+            std::cerr << "pntalloc_grow point " << i << " is " << pts[i-1] << std::endl;
+            return false;
+        }
+    return z.size() == N+1;
+}
+
+
+bool test_make_points()
+{
+    pntalloc z(0.5);
+    pathpoint a = z.make_point(1.0, 1.0);
+    std::vector<double> const xs{0.9, 3.0, 1.1, 3.2}, ys{1.2, 0.0, 0.9, 0.1};
+    // Expect (2,2) [existing], (6,0), (2,2) [again], (6,0) [again]
+    auto pts = z.make_points(xs, ys);
+    if(pts.size() != 4 || pts[0] != a || pts[2] != a || pts[1] != pts[3]
+       || *pts[1] != point(6,0) || z.use_count(a) != 3 || z.use_count(pts[1]) != 2 || z.size() != 2) {
+        std::cerr << "make_points got " << pts.size() << " points " << pts[0] << pts[1] << pts[2] << pts[3] << std::endl;
+        return false;
+    }
+    // 1e300 cannot be snapped to a long
+    std::vector<double> const bad{1.0, 1e300, 2.0, -1e300};
+    try {
+        (void)z.make_points(bad, xs);
+        std::cerr << "make_points expected loss of precision\n";
+        return false;
+    }
+    catch(BadPoint const &e) {
+        if(e.where() != std::vector<std::size_t>{1, 3}) {
+            std::cerr << "make_points wrong precision loss: " << e.what() << std::endl;
+            return false;
+        }
+    }
+    // Nothing was added from the bad batch
+    if(z.size() != 2)
+        return false;
+    // Snapping policies: coordinates already on the grid, or a grid of 2 cells per unit (same as tol)
+    if(z.make_points<snap_none>(std::vector<double>{2.2}, std::vector<double>{1.9})[0] != a
+       || z.snap_point<snap_fixed<2>>(3.1, 0.1) != pts[1] || z.size() != 2) {
+        std::cerr << "make_points snapping policies failed\n";
+        return false;
+    }
+    // A path from columns counts its interior points twice
+    world w(1.0);
+    w.add_path(std::span<double const>(xs).first(3), std::span<double const>(ys).first(3));
+    auto &map = test_paths(w);
+    return map.size() == 1 && map[0].size() == 2 && test_allocator(w).use_count(map[0].begin()->second()) == 2
+        && test_allocator(w).use_count(map[0].begin()->first()) == 2;
+}
+
+
+bool test_snap_euclid()
+{
+    pntalloc z(1.0);
+    pathpoint a = z.make_point(0.45, 0.0);
+    // Same grid point
+    if(z.make_point(0.2, -0.3) != a)
+        return false;
+    // Either side of the grid line at 0.5 are different grid points...
+    pathpoint b = z.make_point(0.55, 0.0);
+    if(b == a || *b != point(1,0)) {
+        std::cerr << "snap grid expected (1,0), got " << b << std::endl;
+        return false;
+    }
+    // ... but the same point if they are within tolerance
+    z.snapping(pntalloc::snap_type_t::SNAP_EUCLID);
+    pathpoint c = z.make_point(-0.55, 0.3);
+    if(c != a) {
+        std::cerr << "snap euclid expected " << a << " got " << c << std::endl;
+        return false;
+    }
+    // Nearest existing point wins: (1,0) is nearer than (0,0)
+    if(z.make_point(0.7, 0.6) != b)
+        return false;
+    // Too far from anything
+    pathpoint d = z.make_point(2.2, 0.9);
+    if(*d != point(2,1) || z.size() != 3) {
+        std::cerr << "snap euclid expected new point (2,1), got " << d << std::endl;
+        return false;
+    }
+    // Bulk snapping works the same way
+    std::vector<double> const xs{-0.9, 2.1, 3.6}, ys{0.0, 1.7, 1.0};
+    auto pts = z.make_points(xs, ys);
+    return pts[0] == a && pts[1] == d && *pts[2] == point(4,1) && z.use_count(a) == 4;
+}
+
+
+bool test_concurrent_import()
+{
+    world w(1.0, true);
+    // Enough points (2N+1) to need several chunks of point storage while the threads add to it
+    constexpr int threads = 4, N = 10000;
+    // Every thread adds the same paths, half directly and half through a buffer
+    auto work = [&w](int k)
+    {
+        world::inserter buf(w);
+        for( int i = 0; i < N; ++i ) {
+            if(k % 2)
+                buf.add_path({{0,0},{i,1},{i,2}});
+            else
+                w.add_path({{0,0},{i,1},{i,2}});
+        }
+    };
+    {
+        std::vector<std::jthread> pool;
+        for( int k = 0; k < threads; ++k )
+            pool.emplace_back(work, k);
+    }
+    auto &u = test_allocator(w);
+    if(test_paths(w).size() != threads*N || u.size() != 2*N+1) {
+        std::cerr << "concurrent import got " << test_paths(w).size() << " paths, " << u.size() << " points\n";
+        return false;
+    }
+    for( pathpoint p : w.points() ) {
+        unsigned expect = p->y() == 0 ? threads*N : p->y() == 1 ? 2*threads : threads;
+        if(u.use_count(p) != expect) {
+            std::cerr << "concurrent import point " << p << " expected count " << expect << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool test_segindex()
+{
+    // A grid of short diagonal segments, enough for a few levels of tree
+    std::vector<segbox> boxes;
+    constexpr int N = 40;
+    for( int i = 0; i < N; ++i )
+        for( int j = 0; j < N; ++j )
+            boxes.emplace_back(10*i, 10*i+5, 10*j, 10*j+5, N*i+j);
+    auto found = [](segindex const &x, segbox const &q)
+    {
+        std::vector<std::size_t> r;
+        x.query(q, [&r](std::size_t s) { r.push_back(s); });
+        std::ranges::sort(r);
+        return r;
+    };
+    segindex x;
+    x.build(boxes);
+    // Boxes (2,3) to (4,5) inclusive
+    std::vector<std::size_t> expect;
+    for( int i = 2; i <= 4; ++i )
+        for( int j = 3; j <= 5; ++j )
+            expect.push_back(N*i+j);
+    if(x.size() != N*N || found(x, segbox(22, 41, 33, 50, 0)) != expect) {
+        std::cerr << "segindex query found " << found(x, segbox(22, 41, 33, 50, 0)).size() << " boxes\n";
+        return false;
+    }
+    // Inserted boxes are found before and after repacking
+    for( int k = 0; k < N*N; ++k )
+        x.insert(segbox(1000+k, 1000+k, 11, 13, N*N+k));
+    std::vector<std::size_t> ray;
+    x.ray(point(395, 12), [&ray](std::size_t s) { ray.push_back(s); });
+    if(!x.stale())
+        return false;
+    x.repack();
+    x.ray(point(395, 12), [&ray](std::size_t s) { ray.push_back(s); });
+    // The last column of the grid, and all the inserted boxes, twice
+    if(x.size() != 2*N*N || x.stale() || ray.size() != 2*(N*N+1)) {
+        std::cerr << "segindex ray found " << ray.size() << " boxes\n";
+        return false;
+    }
+    // The world's index is kept up to date as paths are added and split
+    world w(1.0);
+    w.add_path({{0,0},{10,10}});
+    auto near = [&w](segbox const &q)
+    {
+        std::vector<std::pair<std::size_t,std::pair<point,point>>> r;
+        w.segments_near(q, [&r](std::size_t e, lineseg const &s) { r.push_back({e, {*s.first(), *s.second()}}); });
+        return r;
+    };
+    if(near(segbox(4, 6, 4, 6, 0)).size() != 1)
+        return false;
+    w.add_path({{0,10},{10,0}});
+    w.split_segments(world::split_method_t::SPLIT_INDEX);
+    // Both paths are now split at (5,5), and the new halves are found, too
+    // (the shortened halves keep their old boxes, so they may also be found)
+    auto const r = near(segbox(8, 9, 1, 2, 0));
+    return std::ranges::count(r, std::pair<std::size_t,std::pair<point,point>>{1, {{5,5},{10,0}}}) == 1
+        && near(segbox(4, 6, 4, 6, 0)).size() == 4;
 }
 
 
@@ -132,6 +399,12 @@ test_lineseg()
     const auto gh = u.make_lineseg(u.make_point(1, 3), point{500, -100});
     ret &= expect(u, 5, ab, gh, point{300,100});
     ret &= expect(u, 6, gh, ab, point{300,100});
+    // A segment ending just short of another does not meet it, while one ending on it does, exactly
+    const auto ij = u.make_lineseg(point(0,0), point(1000,0));
+    ret &= expect(u, 7, ij, u.make_lineseg(point(500,1), point(500,2000)), std::nullopt);
+    ret &= expect(u, 8, u.make_lineseg(point(500,2000), point(500,0)), ij, point{500,0});
+    // Collinear segments meeting end to end
+    ret &= expect(u, 9, ij, u.make_lineseg(point(1000,0), point(2000,0)), std::nullopt);
     return ret;
 }
 
@@ -157,6 +430,68 @@ expect(pntalloc &u, int i, lineseg const &v, lineseg const &w, std::optional<poi
 }
 
 
+bool test_batch_intersects()
+{
+    world w(0.01);
+    pntalloc &u = test_allocator(w);
+    // A fan of segments through the origin, plus some near misses and parallels (more than one batch)
+    std::vector<lineseg> all;
+    for( int k = -10; k <= 10; ++k ) {
+        all.push_back(u.make_lineseg(point(-100, -7*k), point(100, 7*k)));
+        all.push_back(u.make_lineseg(point(3*k, 50), point(3*k+1, 150)));
+        all.push_back(u.make_lineseg(point(-100, -7*k+1), point(100, 7*k+1)));
+    }
+    segpack const pack(all);
+    for( lineseg const &v : all )
+        for( std::size_t first = 0; first < all.size(); first += batch_width ) {
+            auto const count = std::min(batch_width, all.size() - first);
+            auto const h = intersects(v, pack, first, count);
+            for( std::size_t k = 0; k < count; ++k ) {
+                auto const z = intersects(v, all[first+k]);
+                bool const hit = h.hits & (1u << k), unsure = h.unsure & (1u << k);
+                // With small coordinates, the filter decides every pair except those meeting at an endpoint
+                bool const touch = z && (v.is_endpoint(*z) || all[first+k].is_endpoint(*z));
+                if((hit && (!z || *z != crossing_point(pack.ax[first+k], pack.ay[first+k],
+                                                       pack.bx[first+k], pack.by[first+k], h.t[k])))
+                   || (!hit && !unsure && z) || (z && !touch && !hit)) {
+                    std::cerr << "batch intersects " << v << " with " << all[first+k] << " disagrees\n";
+                    return false;
+                }
+            }
+        }
+    return true;
+}
+
+
+bool test_sweep_intersections()
+{
+    // Random segments on a small grid meet in every degenerate way: at shared endpoints, an endpoint
+    // on another segment, several through one point, collinear overlaps, vertical and zero length segments.
+    // On a large grid, they cross away from the grid, where the sweep needs its wide arithmetic
+    constexpr point::coord_t large = std::min<point::coord_t>(std::numeric_limits<point::coord_t>::max() / 4, 1ll << 52);
+    std::mt19937_64 gen(17);
+    for( point::coord_t const size : {point::coord_t{6}, point::coord_t{40}, large} )
+        for( int round = 0; round < 4; ++round ) {
+            world w(1.0);
+            pntalloc &u = test_allocator(w);
+            std::uniform_int_distribution<point::coord_t> coord(-size, size);
+            std::vector<lineseg> segs;
+            for( int k = 0; k < 300; ++k )
+                segs.push_back(u.make_lineseg(point(coord(gen), coord(gen)), point(coord(gen), coord(gen))));
+            auto key = [](crossing const &c) { return std::tuple(c.seg, c.at.x(), c.at.y()); };
+            auto brute = brute_intersections(segs), sweep = sweep_intersections(segs);
+            std::ranges::sort(brute, {}, key);
+            std::ranges::sort(sweep, {}, key);
+            if(!std::ranges::equal(brute, sweep, {}, key, key)) {
+                std::cerr << "sweep found " << sweep.size() << " crossings of segments up to " << size
+                          << ", expected " << brute.size() << std::endl;
+                return false;
+            }
+        }
+    return true;
+}
+
+
 bool test_split_seg()
 {
     pntalloc u(0.01);
@@ -166,20 +501,33 @@ bool test_split_seg()
     auto bc{ac.split_at(u,b)};
     auto a1{ac.first()}, b1{ac.last()}, b2{bc.first()}, c2{bc.last()};
     bool ret = true;
-    if(*a1 != a || a1->use_count() != 1) {
-        std::cerr << "split a expected " << a << "[1], got " << a1 << std::endl;
+    if(*a1 != a || u.use_count(a1) != 1) {
+        std::cerr << "split a expected " << a << "[1], got " << a1 << '[' << u.use_count(a1) << ']' << std::endl;
         ret = false;
     }
-    if(*b1 != b || b1->use_count() != 2) {
-        std::cerr << "split b expected " << b << "[2], got " << b1 << std::endl;
+    if(*b1 != b || u.use_count(b1) != 2) {
+        std::cerr << "split b expected " << b << "[2], got " << b1 << '[' << u.use_count(b1) << ']' << std::endl;
         ret = false;
     }
     if(b1 != b2) {
         std::cerr << "split end segment 1 doesn't match start of 2: " << b1 << ' ' << b2 << std::endl;
         ret = false;
     }
-    if(*c2 != c || c2->use_count() != 1) {
-        std::cerr << "split c expected " << c << "[1], got " << c2 << std::endl;
+    if(*c2 != c || u.use_count(c2) != 1) {
+        std::cerr << "split c expected " << c << "[1], got " << c2 << '[' << u.use_count(c2) << ']' << std::endl;
+        ret = false;
+    }
+    // Splitting the first segment of a path at two points at once should give three segments
+    std::vector<pathpoint> const de{u.make_point(point(5,1)), u.make_point(point(7,1))};
+    path bf(u, {{4,1}, {9,1}, {9,4}});
+    std::vector<std::pair<std::size_t, pathpoint>> const at{{0, de[0]}, {0, de[1]}};
+    bf.split_at(u, at);
+    if(u.use_count(de[0]) != 2 || u.use_count(de[1]) != 2) {
+        std::cerr << "split at two points expected use counts 2, got " << de[0] << ' ' << de[1] << std::endl;
+        ret = false;
+    }
+    if(bf.size() != 4 || bf != path(u, {{4,1}, {5,1}, {7,1}, {9,1}, {9,4}})) {
+        std::cerr << "split at two points got " << bf << std::endl;
         ret = false;
     }
     return ret;
@@ -271,7 +619,7 @@ bool test_poly2()
             std::cerr << "poly2: unexpected point " << y << '\n';
             ret = false;
         } else {
-            if( 2 * z->second != y->use_count() ) {
+            if( 2 * z->second != u.use_count(y) ) {
                 std::cerr << "poly2: " << y << " expected " << z->second << " count\n";
                 ret = false;
             }
@@ -287,6 +635,67 @@ bool test_poly2()
 }
 
 
+bool test_split_sweep()
+{
+    using method = world::split_method_t;
+    // Paths as in test_poly2, plus a path crossing the same segment twice, and the big world
+    auto small = [](method m, unsigned threads)
+    {
+        world w(0.01);
+        w.add_path({{-2, 2},{-1,2},{-1,-2},{2,-2},{2,1},{3,2}});
+        w.add_path({{-3, 1},{3,1}});
+        w.add_path({{0,-3},{0,3},{1,3},{1,-3}});
+        w.split_segments(m, threads);
+        return w;
+    };
+    auto big = [](method m, unsigned threads)
+    {
+        world w = make_big_world(4);
+        w.split_segments(m, threads);
+        return w;
+    };
+    // Paths added to a split world (crossing it and each other) are split incrementally
+    auto twice = [](method m, unsigned threads)
+    {
+        world w = make_big_world(3);
+        w.split_segments(m, threads);
+        w.split_segments(m, threads);
+        w.add_path({{1,-1},{7,9},{7,-1},{1,9}});
+        w.add_path({{-1,2},{9,4}});
+        w.split_segments(m, threads);
+        return w;
+    };
+    using maker = std::function<world(method, unsigned)>;
+    for( maker make : {maker(small), maker(big), maker(twice)} ) {
+        std::ostringstream brute;
+        brute << make(method::SPLIT_BRUTE, 0);
+        // The tiled split must not depend on the number of threads (and hence of tiles)
+        for( auto [m, threads] : {std::pair(method::SPLIT_SWEEP, 0u), std::pair(method::SPLIT_INTERVALS, 0u),
+                                  std::pair(method::SPLIT_INDEX, 0u),
+                                  std::pair(method::SPLIT_TILED, 1u), std::pair(method::SPLIT_TILED, 5u),
+                                  std::pair(method::SPLIT_CHAINS, 0u)} ) {
+            std::ostringstream other;
+            other << make(m, threads);
+            if(brute.view() != other.view()) {
+                std::cerr << "split method " << static_cast<int>(m) << " (" << threads << " threads) got\n"
+                          << other.view() << "expected\n" << brute.view();
+                return false;
+            }
+        }
+    }
+    // After the incremental split, segments meet only at endpoints, as after a full split
+    world w = twice(method::SPLIT_INDEX, 0);
+    std::vector<lineseg> lines;
+    for( lineseg const &s : w.segments() )
+        lines.push_back(s);
+    if(auto const left = brute_intersections(lines); !left.empty()) {
+        std::cerr << "incremental split left " << left.size() << " crossings, eg at " << left.front().at << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
 bool test_path_iter()
 {
     world w(0.01);
@@ -314,9 +723,22 @@ bool test_branch_points()
     std::set<point> const expect{{-100,0},{0,0},{100,100},{-200,100}};
     std::set<point> found;
     // though not necessarily in that order
+    for( auto p : w.branch_points() ) {
+        if(!w.is_branch_point(p))
+            return false;
+        found.insert(*p);
+    }
+    if(found != expect)
+        return false;
+    // Three separate paths between two new points make both branch points;
+    // the list of branch points must not be kept from before
+    for( int y : {1100, 1200, 1300} )
+        w.add_path({{1000,1000},{1050,y},{1100,1000}});
+    std::set<point> const expect2{{-100,0},{0,0},{100,100},{-200,100},{1000,1000},{1100,1000}};
+    found.clear();
     for( auto p : w.branch_points() )
         found.insert(*p);
-    return found == expect;
+    return found == expect2;
 }
 
 
@@ -383,6 +805,453 @@ bool test_path_split()
 }
 
 
+bool test_path_split_alloc()
+{
+    // Long paths, each cut into four
+    world w(1.0);
+    constexpr int rows = 64, cols = 1000;
+    std::vector<point> at;
+    for( int r = 0; r < rows; ++r ) {
+        std::vector<double> xs, ys;
+        for( int c = 0; c < cols; ++c ) {
+            xs.push_back(c);
+            ys.push_back(r);
+        }
+        w.add_path(xs, ys);
+        for( int c : {250, 500, 750} )
+            at.emplace_back(c, r);
+    }
+    auto const before = allocation_count();
+    w.proper_paths(std::move(at));
+    auto const count = allocation_count() - before;
+    // Each new path gets its own points once, and the rest only move;
+    // the vector of new paths grows geometrically.  Allocations are only counted in test builds
+    // (see alloc-count.h)
+    auto const paths = w.map().size();
+#ifdef VEC2POLY_COUNT_ALLOCATIONS
+    bool const many = count > paths + 64;
+#else
+    bool const many = false;
+#endif
+    if(paths != 4*rows || many) {
+        std::cerr << "proper_paths made " << count << " allocations for " << paths << " paths of "
+                  << std::ranges::distance(w.segments()) << " segments\n";
+        return false;
+    }
+    return true;
+}
+
+
+bool test_path_split_threads()
+{
+    // Enough paths for several blocks; the result must not depend on the number of threads
+    auto split = [](unsigned threads)
+    {
+        world w(1.0);
+        std::vector<point> at;
+        for( int r = 0; r < 1000; ++r ) {
+            w.add_path({{0,r},{1,r},{2,r},{3,r},{4,r}});
+            at.emplace_back(r % 3 + 1, r);
+        }
+        w.proper_paths(std::move(at), threads);
+        std::ostringstream os;
+        os << w;
+        return os.str();
+    };
+    auto const one = split(1);
+    for( unsigned threads : {2u, 3u, 8u} )
+        if(split(threads) != one) {
+            std::cerr << "proper_paths with " << threads << " threads differs from one thread\n";
+            return false;
+        }
+    return true;
+}
+
+
+/** Check proper paths of the paths in w, made by tiles of the given size, against those of the whole world.
+ * The tiles add points where paths cross their borders, rounded to the grid.  For paths along rows
+ * and columns (see tiled_map), once those are taken out every proper path must be one of the whole
+ * world's, point for point, and each added point must be within a grid cell of its neighbours' box */
+static bool test_tiled_map1(world &w, point::coord_t cells, std::size_t tiles)
+{
+    // Points are only partially ordered, so they are compared as coordinate pairs
+    using coords = std::pair<point::coord_t, point::coord_t>;
+    // A path from its lesser end, or a loop from its least point towards the lesser of its neighbours
+    auto canonical = [](std::vector<coords> c)
+    {
+        if(c.front() == c.back()) {
+            c.pop_back();
+            std::ranges::rotate(c, std::ranges::min_element(c));
+            if(c.size() > 2 && c.back() < c[1])
+                std::reverse(c.begin() + 1, c.end());
+            c.push_back(c.front());
+        } else if(c.back() < c.front())
+            std::ranges::reverse(c);
+        return c;
+    };
+    std::vector<std::vector<coords>> expected, found;
+
+    tiled_map t(1.0, cells);
+    for( path const &p : w.map() ) {
+        std::vector<double> xs, ys;
+        p.points([&xs, &ys](pathpoint q) { xs.push_back(q->x()); ys.push_back(q->y()); });
+        t.add_path(xs, ys);
+    }
+    w.split_segments(world::split_method_t::SPLIT_INTERVALS);
+    w.proper_paths();
+    std::set<coords> known;
+    for( path const &p : w.map() ) {
+        std::vector<coords> c;
+        p.points([&c](pathpoint q) { c.emplace_back(q->x(), q->y()); });
+        known.insert(c.begin(), c.end());
+        expected.push_back(canonical(std::move(c)));
+    }
+    if(t.tiles() != tiles) {
+        std::cerr << "tiled map has " << t.tiles() << " tiles, expected " << tiles << '\n';
+        return false;
+    }
+    bool near = true;
+    t.proper_paths([&](std::vector<point> const &p)
+    {
+        std::vector<coords> c;
+        for( std::size_t k = 0; k < p.size(); ++k ) {
+            coords const q(p[k].x(), p[k].y());
+            if((q.first % cells != 0 && q.second % cells != 0) || known.contains(q)) {
+                c.push_back(q);
+                continue;
+            }
+            // Added on a border: only the ends of a loop have no neighbour on one side
+            point const a = k > 0 ? p[k-1] : p[p.size()-2], b = k+1 < p.size() ? p[k+1] : p[1];
+            if(q.first < std::min(a.x(), b.x()) - 1 || q.first > std::max(a.x(), b.x()) + 1
+               || q.second < std::min(a.y(), b.y()) - 1 || q.second > std::max(a.y(), b.y()) + 1) {
+                std::cerr << "tiled map added " << p[k] << " between " << a << " and " << b << '\n';
+                near = false;
+            }
+        }
+        found.push_back(canonical(std::move(c)));
+    });
+    std::ranges::sort(expected);
+    std::ranges::sort(found);
+    if(found != expected) {
+        std::cerr << "tiled map (" << cells << " cells) made " << found.size()
+                  << " proper paths, expected " << expected.size() << '\n';
+        return false;
+    }
+    return near && t.tiles() == 0;
+}
+
+
+bool test_tiled_map()
+{
+    // A frame with lines across it, a loop touching a tile border and a loop across two borders
+    world w(1.0);
+    w.add_path({{0,0},{0,20},{20,20},{20,0},{0,0}});
+    for( int y : {3, 7, 11} )
+        w.add_path({{0,y},{20,y}});
+    for( int x : {2, 9, 13} )
+        w.add_path({{x,0},{x,20}});
+    w.add_path({{10,15},{12,15},{12,18},{10,18},{10,15}});
+    w.add_path({{14,13},{17,13},{17,16},{14,16},{14,13}});
+    // Tiles are 5 grid cells across, so 5x5 of them, but the corner tile at (20,20) only
+    // holds the ends of the frame within half a cell of its border, which round to nothing
+    if(!test_tiled_map1(w, 5, 24))
+        return false;
+    // Every line of the big world is on a row or column of some tile;
+    // its 33x33 grid cells make 11x11 or 5x5 tiles, but not all of them hold any lines.
+    // The check splits the world, so each tiling gets a fresh one
+    for( auto [cells, tiles] : {std::pair<point::coord_t, std::size_t>(3, 101), std::pair<point::coord_t, std::size_t>(7, 24)} ) {
+        world big = make_big_world(5);
+        if(!test_tiled_map1(big, cells, tiles))
+            return false;
+    }
+
+    // A line from the frame ending in the middle of nowhere is rejected as by the whole world,
+    // whether its loose end is within a tile or on a border (where it is only found after joining)
+    for( int end : {12, 10} ) {
+        tiled_map t(1.0, 5);
+        for( path const &p : w.map() ) {
+            std::vector<double> xs, ys;
+            p.points([&xs, &ys](pathpoint q) { xs.push_back(q->x()); ys.push_back(q->y()); });
+            t.add_path(xs, ys);
+        }
+        std::vector<double> const xs{0, static_cast<double>(end)}, ys{8, 8};
+        t.add_path(xs, ys);
+        try {
+            t.proper_paths([](std::vector<point> const &) {});
+            std::cerr << "tiled map accepted a line ending at (" << end << ",8)\n";
+            return false;
+        }
+        catch(BadWorld const &) {
+        }
+    }
+    return true;
+}
+
+
+bool test_snapshot()
+{
+    // A file of our own, removed however the test ends
+    struct temp_file {
+        std::string name;
+        temp_file() : name((std::filesystem::temp_directory_path() / ("vec2poly-" + std::to_string(::getpid()) + ".v2p")).string()) {}
+        ~temp_file() { std::filesystem::remove(name); }
+    } const tmp;
+    auto const &file = tmp.name;
+    world w = make_big_world(4);
+    w.split_segments(world::split_method_t::SPLIT_INTERVALS);
+    w.proper_paths();
+    w.write_snapshot(file);
+    bool ok = true;
+    {
+        snapshot const snap(file);
+        world v(snap);
+        std::ostringstream a, b;
+        a << w;
+        b << v;
+        if(a.str() != b.str()) {
+            std::cerr << "snapshot restored a different world\n";
+            ok = false;
+        }
+        // The same points, by id, used as often
+        auto const wp = w.points(), vp = v.points();
+        if(!std::ranges::equal(wp, vp, [&wu = test_allocator(w), &vu = test_allocator(v)](pathpoint p, pathpoint q)
+            { return *p == *q && p->id() == q->id() && wu.use_count(p) == vu.use_count(q); })
+           || !std::ranges::equal(w.branch_points(), v.branch_points(), [](pathpoint p, pathpoint q) { return *p == *q; })) {
+            std::cerr << "snapshot restored different points\n";
+            ok = false;
+        }
+        // ... which can be looked up, once they are indexed
+        for( pathpoint p : w.branch_points() )
+            if(test_allocator(v).lookup(*p) != static_cast<ssize_t>(p->id())) {
+                std::cerr << "snapshot point " << p << " not found\n";
+                ok = false;
+            }
+        // The restored world is split, so a path added to it is split incrementally
+        v.add_path({{-1,-1},{7,5}});
+        v.split_segments();
+        std::vector<lineseg> lines;
+        for( lineseg const &s : v.segments() )
+            lines.push_back(s);
+        if(auto const left = brute_intersections(lines); !left.empty()) {
+            std::cerr << "split of snapshot left " << left.size() << " crossings\n";
+            ok = false;
+        }
+    }
+    // A header whose path count overflows is rejected by the bounds checks, before the paths are read
+    {
+        std::fstream fs(file, std::ios::in | std::ios::out | std::ios::binary);
+        snapshot_header h{};
+        fs.read(reinterpret_cast<char *>(&h), sizeof(h));
+        h.paths = std::numeric_limits<std::uint64_t>::max();
+        fs.seekp(0);
+        fs.write(reinterpret_cast<char const *>(&h), sizeof(h));
+    }
+    try {
+        snapshot const bad(file);
+        std::cerr << "snapshot accepted a header with too many paths\n";
+        ok = false;
+    }
+    catch(BadSnapshot const &e) {
+        if(std::string_view(e.what()).find("cut short") == std::string_view::npos) {
+            std::cerr << "snapshot with too many paths got past the bounds checks: " << e.what() << '\n';
+            ok = false;
+        }
+    }
+    // Anything else is rejected
+    {
+        std::ofstream os(file, std::ios::trunc);
+        os << std::string(2 * sizeof(snapshot_header), 'x');
+    }
+    try {
+        snapshot const bad(file);
+        std::cerr << "snapshot accepted a file which is not one\n";
+        ok = false;
+    }
+    catch(BadSnapshot const &) {
+    }
+    // Loaded points are only indexed when first looked up, which finds any that are the same
+    world d(1.0);
+    std::vector<std::int64_t> const xs{0, 1, 0}, ys{0, 0, 0};
+    test_allocator(d).load(xs, ys);
+    try {
+        (void)test_allocator(d).lookup(point(1,0));
+        std::cerr << "snapshot: loaded points which are not distinct were indexed\n";
+        ok = false;
+    }
+    catch(BadPoint const &) {
+    }
+    return ok;
+}
+
+
+bool test_simplify()
+{
+    world w(1.0);
+    // Wobbly lines, one of them met by another path half way
+    w.add_path({{0,0},{10,1},{20,0},{30,1},{40,0}});
+    w.add_path({{0,10},{10,11},{20,10},{30,11},{40,10}});
+    w.add_path({{20,10},{20,20}});
+    // A small loop, and a spike
+    w.add_path({{0,30},{1,30},{1,31},{0,30}});
+    w.add_path({{0,50},{20,60},{40,50}});
+    std::vector<std::vector<point>> const expected{
+        {{0,0},{40,0}}, {{0,10},{20,10},{40,10}}, {{20,10},{20,20}},
+        {{0,30},{1,30},{1,31},{0,30}}, {{0,50},{20,60},{40,50}}};
+    if(auto const dropped = w.simplify(1.5); dropped != 5) {
+        std::cerr << "simplify dropped " << dropped << " points, expected 5\n";
+        return false;
+    }
+    std::vector<std::vector<point>> found;
+    for( path const &p : w.map() ) {
+        auto &pts = found.emplace_back();
+        p.points([&pts](pathpoint q) { pts.push_back(*q); });
+    }
+    if(found != expected) {
+        std::cerr << "simplify made the wrong paths\n" << w;
+        return false;
+    }
+    // Dropped points are no longer used, and the shared point is still a branch point
+    pntalloc &u = test_allocator(w);
+    auto at = [&u](point p) { return u.at(static_cast<pointid_t>(u.lookup(p))); };
+    if(u.use_count(at({10,1})) != 0 || u.use_count(at({30,11})) != 0 || !w.is_branch_point(at({20,10}))) {
+        std::cerr << "simplify left the wrong use counts\n";
+        return false;
+    }
+    return true;
+}
+
+
+bool test_clean()
+{
+    world w(1.0);
+    // A zero length segment
+    w.add_path({{0,0},{0,0},{10,0}});
+    // A path drawn twice, the other way, and a loop drawn twice from another point
+    w.add_path({{0,10},{10,10},{20,10}});
+    w.add_path({{20,10},{10,10},{0,10}});
+    w.add_path({{0,20},{10,20},{10,30},{0,20}});
+    w.add_path({{10,20},{10,30},{0,20},{10,20}});
+    // Collinear segments overlapping, and a path going back on itself
+    w.add_path({{0,40},{20,40}});
+    w.add_path({{10,40},{30,40}});
+    w.add_path({{0,50},{10,50},{5,50}});
+    auto const removed = w.clean();
+    if(removed.zero_length != 1 || removed.duplicate_paths != 2 || removed.overlaps != 2) {
+        std::cerr << "clean removed " << removed.zero_length << ',' << removed.duplicate_paths << ','
+                  << removed.overlaps << ", expected 1,2,2\n";
+        return false;
+    }
+    std::vector<std::vector<point>> const expected{
+        {{0,0},{10,0}}, {{0,10},{10,10},{20,10}}, {{0,20},{10,20},{10,30},{0,20}},
+        {{0,40},{10,40},{20,40}}, {{20,40},{30,40}}, {{0,50},{5,50},{10,50}}};
+    pntalloc &u = test_allocator(w);
+    std::vector<std::vector<point>> found;
+    std::vector<unsigned> uses(u.size());
+    for( path const &p : w.map() ) {
+        auto &pts = found.emplace_back();
+        p.points([&pts](pathpoint q) { pts.push_back(*q); });
+        for( lineseg const s : p ) {
+            ++uses[s.first()->id()];
+            ++uses[s.last()->id()];
+        }
+    }
+    if(found != expected) {
+        std::cerr << "clean made the wrong paths\n" << w;
+        return false;
+    }
+    // Use counts still count the segment ends at each point
+    for( pointid_t id = 0; id < u.size(); ++id )
+        if(u.use_count(u.at(id)) != uses[id]) {
+            std::cerr << "clean left use count " << u.use_count(u.at(id)) << " at " << *u.at(id)
+                      << ", expected " << uses[id] << '\n';
+            return false;
+        }
+    // Nothing more to remove
+    auto const again = w.clean();
+    return again.zero_length + again.duplicate_paths + again.overlaps == 0;
+}
+
+
+bool test_hilbert_order()
+{
+    // A square, drawn starting in the wrong corner
+    world w(1.0);
+    w.add_path({{1,0},{1,1}});
+    w.add_path({{0,0},{0,1}});
+    w.add_path({{0,1},{1,1}});
+    w.add_path({{0,0},{1,0}});
+    w.hilbert_order();
+    // The curve through a 2x2 grid goes up, right, and down
+    pntalloc &u = test_allocator(w);
+    std::vector<point> const corners{{0,0},{0,1},{1,1},{1,0}};
+    for( pointid_t id = 0; id < corners.size(); ++id )
+        if(*u.at(id) != corners[id] || u.use_count(u.at(id)) != 2 || u.lookup(corners[id]) != static_cast<ssize_t>(id)) {
+            std::cerr << "hilbert_order: point " << id << " is " << u.at(id) << ", expected " << corners[id] << '\n';
+            return false;
+        }
+    std::vector<std::pair<point, point>> const expected{
+        {{0,0},{0,1}}, {{0,0},{1,0}}, {{0,1},{1,1}}, {{1,0},{1,1}}};
+    std::vector<std::pair<point, point>> found;
+    for( path const &p : w.map() )
+        found.emplace_back(*p.endpoints().first, *p.endpoints().second);
+    if(found != expected) {
+        std::cerr << "hilbert_order: paths in the wrong order\n" << w;
+        return false;
+    }
+    // The world still works
+    w.proper_paths();
+    if(w.map().size() != 4 || !w.branch_points().empty())
+        return false;
+
+    // The same square, wider than the range of a 32-bit coordinate, is placed on the curve the same way
+    constexpr point::coord_t far = 2000000000;
+    world big(1.0);
+    big.add_path({{far,-far},{far,far}});
+    big.add_path({{-far,-far},{-far,far}});
+    big.add_path({{-far,far},{far,far}});
+    big.add_path({{-far,-far},{far,-far}});
+    big.hilbert_order();
+    pntalloc &v = test_allocator(big);
+    for( pointid_t id = 0; id < corners.size(); ++id ) {
+        point const c(corners[id].x() ? far : -far, corners[id].y() ? far : -far);
+        if(*v.at(id) != c) {
+            std::cerr << "hilbert_order: wide map point " << id << " is " << v.at(id) << ", expected " << c << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool test_split_euclid()
+{
+    // With Euclidean snapping, crossings are still made exactly where they are:
+    // the crossing at (5,5) is one cell from the point (5,6), and the one at (1,20)
+    // is one cell from the end of its own segment
+    world w(1.0);
+    test_allocator(w).snapping(pntalloc::snap_type_t::SNAP_EUCLID);
+    w.add_path({{0,0},{10,10}});
+    w.add_path({{0,10},{10,0}});
+    w.add_path({{5,6},{5,7}});
+    w.add_path({{0,20},{10,20}});
+    w.add_path({{1,15},{1,25}});
+    w.split_segments();
+    std::vector<std::vector<point>> const expected{
+        {{0,0},{5,5},{10,10}}, {{0,10},{5,5},{10,0}}, {{5,6},{5,7}},
+        {{0,20},{1,20},{10,20}}, {{1,15},{1,20},{1,25}}};
+    std::vector<std::vector<point>> found;
+    for( path const &p : w.map() ) {
+        auto &pts = found.emplace_back();
+        p.points([&pts](pathpoint q) { pts.push_back(*q); });
+    }
+    if(found != expected) {
+        std::cerr << "split_euclid: crossings were snapped\n" << w;
+        return false;
+    }
+    return true;
+}
+
+
 bool test_make_poly1()
 {
     polygon p(4,0);
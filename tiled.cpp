@@ -0,0 +1,313 @@
+//
+// Created by jens on 17/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+#include "tiled.h"
+
+
+/** Snapped coordinates at least this large are not exact integers in a double
+ * (or do not fit in a coordinate), as in the point factory */
+static constexpr double snap_limit = std::min(0x1p53, static_cast<double>(std::numeric_limits<point::coord_t>::max()));
+
+
+tiled_map::tiled_map(double tol, point::coord_t cells) : tol_(tol), cells_(cells), spool_(std::tmpfile(), &std::fclose), last_(), ends_()
+{
+    if(cells_ < 2)
+        throw BadTiles("Tiles must be at least two grid cells across");
+    if(!spool_)
+        throw BadTiles("Cannot create spool file for tiles");
+}
+
+
+std::int64_t tiled_map::tile_of(point::coord_t v) const noexcept
+{
+    // Division rounding down, also for negative v
+    auto const q = static_cast<std::int64_t>(v / cells_);
+    return (v % cells_ < 0) ? q-1 : q;
+}
+
+
+void tiled_map::add_path(std::span<double const> xs, std::span<double const> ys)
+{
+    if(xs.size() != ys.size())
+        throw BadPoint("add_path needs as many y coordinates as x coordinates");
+    if(xs.size() < 2)
+        throw BadPath("Path too short");
+    // Snap as the point factory does
+    double const inv_tol = 1.0/tol_;
+    std::vector<point> pts;
+    pts.reserve(xs.size());
+    for(std::size_t i = 0; i < xs.size(); ++i) {
+        double const u = std::round(snap_grid::scale(xs[i], inv_tol)), v = std::round(snap_grid::scale(ys[i], inv_tol));
+        if(!(std::fabs(u) < snap_limit && std::fabs(v) < snap_limit)) {
+            std::ostringstream msg;
+            msg << "Coordinates " << xs[i] << ',' << ys[i] << " lose precision when snapped to grid " << tol_;
+            throw BadPoint(msg.str());
+        }
+        pts.emplace_back(static_cast<point::coord_t>(u), static_cast<point::coord_t>(v));
+    }
+
+    // A path (other than a loop) ending on a shared row or column is never joined to another there
+    if(pts.front() != pts.back())
+        for(point const q : {pts.front(), pts.back()})
+            if(on_border(q))
+                ends_.insert(q);
+
+    // Tile of a point not on the grid (which is never on a border)
+    double const c = static_cast<double>(cells_);
+    auto tile = [c](double v) { return static_cast<std::int64_t>(std::floor((v + 0.5) / c)); };
+    // Cut every segment where it crosses a border, and spool the pieces of the path in each tile.
+    // A border point is rounded to the first row or column beyond the border, which is where
+    // the tile it rounds into starts
+    std::vector<point> piece;
+    std::pair<std::int64_t, std::int64_t> current;
+    std::vector<std::pair<double, point>> cuts;
+    for(std::size_t k = 0; k+1 < pts.size(); ++k) {
+        point const a = pts[k], b = pts[k+1];
+        if(a == b)
+            continue;
+        double const ax = a.x(), ay = a.y(), dx = b.x() - ax, dy = b.y() - ay;
+        cuts.assign({{0.0, a}, {1.0, b}});
+        auto const x0 = std::min(tile_of(a.x()), tile_of(b.x())), x1 = std::max(tile_of(a.x()), tile_of(b.x()));
+        for(auto i = x0+1; i <= x1; ++i) {
+            double const t = (static_cast<double>(i) * c - 0.5 - ax) / dx;
+            cuts.emplace_back(t, point(static_cast<point::coord_t>(i * cells_),
+                                       static_cast<point::coord_t>(std::floor(ay + t * dy + 0.5))));
+        }
+        auto const y0 = std::min(tile_of(a.y()), tile_of(b.y())), y1 = std::max(tile_of(a.y()), tile_of(b.y()));
+        for(auto j = y0+1; j <= y1; ++j) {
+            double const t = (static_cast<double>(j) * c - 0.5 - ay) / dy;
+            cuts.emplace_back(t, point(static_cast<point::coord_t>(std::floor(ax + t * dx + 0.5)),
+                                       static_cast<point::coord_t>(j * cells_)));
+        }
+        std::ranges::sort(cuts, {}, &std::pair<double, point>::first);
+        for(std::size_t m = 0; m+1 < cuts.size(); ++m) {
+            auto const &[t0, p0] = cuts[m];
+            auto const &[t1, p1] = cuts[m+1];
+            // A path through the corner of a tile crosses two borders at the same point
+            if(p0 == p1)
+                continue;
+            double const tm = (t0 + t1) / 2;
+            std::pair const here{tile(ax + tm * dx), tile(ay + tm * dy)};
+            if(piece.empty() || here != current) {
+                if(!piece.empty())
+                    spool(current, piece);
+                piece.assign({p0});
+                current = here;
+            }
+            piece.push_back(p1);
+        }
+    }
+    if(!piece.empty())
+        spool(current, piece);
+}
+
+
+void tiled_map::spool(std::pair<std::int64_t, std::int64_t> tile, std::vector<point> const &piece)
+{
+    std::FILE *f = spool_.get();
+    if(std::fseek(f, 0, SEEK_END) != 0)
+        throw BadTiles("Cannot seek in spool file");
+    long const pos = std::ftell(f);
+    auto const found = last_.find(tile);
+    std::int64_t const head[2] = {found == last_.end() ? -1 : found->second, static_cast<std::int64_t>(piece.size())};
+    std::vector<std::int64_t> body;
+    body.reserve(2 * piece.size());
+    for(point const p : piece) {
+        body.push_back(p.x());
+        body.push_back(p.y());
+    }
+    if(pos < 0 || std::fwrite(head, sizeof(head[0]), 2, f) != 2
+       || std::fwrite(body.data(), sizeof(body[0]), body.size(), f) != body.size())
+        throw BadTiles("Cannot write spool file");
+    last_[tile] = pos;
+}
+
+
+std::vector<std::vector<point>> tiled_map::unspool(long last)
+{
+    std::FILE *f = spool_.get();
+    std::vector<std::vector<point>> pieces;
+    std::vector<std::int64_t> body;
+    for(std::int64_t pos = last; pos >= 0; ) {
+        std::int64_t head[2];
+        if(std::fseek(f, static_cast<long>(pos), SEEK_SET) != 0 || std::fread(head, sizeof(head[0]), 2, f) != 2)
+            throw BadTiles("Cannot read spool file");
+        body.resize(2 * static_cast<std::size_t>(head[1]));
+        if(std::fread(body.data(), sizeof(body[0]), body.size(), f) != body.size())
+            throw BadTiles("Cannot read spool file");
+        auto &piece = pieces.emplace_back();
+        piece.reserve(body.size() / 2);
+        for(std::size_t k = 0; k < body.size(); k += 2)
+            piece.emplace_back(static_cast<point::coord_t>(body[k]), static_cast<point::coord_t>(body[k+1]));
+        pos = head[0];
+    }
+    return pieces;
+}
+
+
+void tiled_map::proper_paths(sink_t const &sink, world::split_method_t method)
+{
+    // Paths ending on a row or column shared with other tiles
+    std::vector<std::vector<point>> open;
+    std::vector<double> xs, ys;
+    for(auto const &y : last_) {
+        // The points are already on the grid
+        world w(1.0);
+        for(auto const &piece : unspool(y.second)) {
+            xs.clear();
+            ys.clear();
+            for(point const p : piece) {
+                xs.push_back(p.x());
+                ys.push_back(p.y());
+            }
+            w.add_path(xs, ys);
+        }
+        w.split_segments(method);
+        // Points on shared rows and columns may be joined to paths in other tiles,
+        // which is only known when all tiles are done; they are checked once they are joined
+        std::vector<point> bps;
+        for(path const &p : w.map())
+            p.points([this, &w, &bps](pathpoint q)
+            {
+                if(on_border(*q))
+                    bps.push_back(*q);
+                else if(w.is_branch_point(q))
+                    bps.push_back(*q);
+                else if(w.is_unconnected(q))
+                    unconnected(*q);
+            });
+        if(!bps.empty())
+            w.proper_paths(std::move(bps));
+        for(path const &p : w.map()) {
+            std::vector<point> pts;
+            pts.reserve(p.size() + 1);
+            p.points([&pts](pathpoint q) { pts.push_back(*q); });
+            if(on_border(pts.front()) || on_border(pts.back()))
+                open.push_back(std::move(pts));
+            else
+                sink(pts);
+        }
+    }
+    // Start again with an empty spool
+    last_.clear();
+    spool_.reset(std::tmpfile());
+    if(!spool_)
+        throw BadTiles("Cannot create spool file for tiles");
+    join(std::move(open), sink);
+    ends_.clear();
+}
+
+
+void tiled_map::unconnected(point q)
+{
+    std::ostringstream msg;
+    msg << "Unconnected line segment found at " << q;
+    throw BadWorld(msg.view());
+}
+
+
+void tiled_map::split_borders(std::vector<std::vector<point>> &open) const
+{
+    // Ends of paths on each shared row and column, in order along it
+    std::map<point::coord_t, std::vector<point::coord_t>> rows, cols;
+    for(auto const &p : open)
+        for(point const q : {p.front(), p.back()}) {
+            if(on_border(q.y()))
+                rows[q.y()].push_back(q.x());
+            if(on_border(q.x()))
+                cols[q.x()].push_back(q.y());
+        }
+    for(auto *line : {&rows, &cols})
+        for(auto &[_, at] : *line) {
+            std::ranges::sort(at);
+            at.erase(std::unique(at.begin(), at.end()), at.end());
+        }
+    // Ends strictly between u and v on a line, in order from u
+    auto between = [](std::vector<point::coord_t> const &at, point::coord_t u, point::coord_t v)
+    {
+        auto const lo = std::upper_bound(at.begin(), at.end(), std::min(u, v));
+        auto const hi = std::lower_bound(lo, at.end(), std::max(u, v));
+        std::vector<point::coord_t> result(lo, hi);
+        if(u > v)
+            std::ranges::reverse(result);
+        return result;
+    };
+    std::vector<std::vector<point>> result;
+    result.reserve(open.size());
+    for(auto const &p : open) {
+        std::vector<point> piece{p.front()};
+        for(std::size_t k = 0; k+1 < p.size(); ++k) {
+            point const a = p[k], b = p[k+1];
+            std::vector<point> at;
+            if(a.y() == b.y())
+                if(auto const r = rows.find(a.y()); r != rows.end())
+                    for(auto x : between(r->second, a.x(), b.x()))
+                        at.emplace_back(x, a.y());
+            if(a.x() == b.x())
+                if(auto const c = cols.find(a.x()); c != cols.end())
+                    for(auto y : between(c->second, a.y(), b.y()))
+                        at.emplace_back(a.x(), y);
+            for(point const q : at) {
+                piece.push_back(q);
+                result.push_back(std::move(piece));
+                piece.assign({q});
+            }
+            piece.push_back(b);
+        }
+        result.push_back(std::move(piece));
+    }
+    open = std::move(result);
+}
+
+
+void tiled_map::join(std::vector<std::vector<point>> &&open, sink_t const &sink) const
+{
+    split_borders(open);
+    // Ends of paths at each point: twice the path's index, plus one for its back
+    std::unordered_map<point, std::vector<std::size_t>> ends;
+    auto end_point = [&open](std::size_t e) { return e % 2 ? open[e/2].back() : open[e/2].front(); };
+    for(std::size_t e = 0; e < 2 * open.size(); ++e)
+        ends[end_point(e)].push_back(e);
+    // Every point on a shared row or column is now the end of a path, so a single end
+    // there is a segment which meets no other in any tile
+    for(auto const &[q, at] : ends)
+        if(at.size() == 1 && on_border(q))
+            unconnected(q);
+    // Paths are only joined where they were split at tile borders, when exactly two ends meet
+    auto joins = [this, &ends](point q) { return on_border(q) && !ends_.contains(q) && ends[q].size() == 2; };
+    std::vector<bool> done(open.size());
+    // Join paths into a chain starting at end e, for as long as they join
+    auto follow = [&](std::size_t e)
+    {
+        std::vector<point> chain;
+        for(;;) {
+            auto &p = open[e/2];
+            done[e/2] = true;
+            if(e % 2)
+                std::ranges::reverse(p);
+            chain.insert(chain.end(), p.begin() + (chain.empty() ? 0 : 1), p.end());
+            // Arrived at the other end of the path
+            if(!joins(chain.back()))
+                break;
+            auto const &at = ends[chain.back()];
+            auto const next = at[0] == (e ^ 1) ? at[1] : at[0];
+            if(done[next/2])
+                break;
+            e = next;
+        }
+        sink(chain);
+    };
+    for(std::size_t e = 0; e < 2 * open.size(); ++e)
+        if(!done[e/2] && !joins(end_point(e)))
+            follow(e);
+    // What remains are loops
+    for(std::size_t k = 0; k < open.size(); ++k)
+        if(!done[k])
+            follow(2*k);
+}
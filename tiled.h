@@ -0,0 +1,109 @@
+//
+// Proper paths of maps too large to hold in memory, made one tile at a time
+// Created by jens on 17/10/26.
+//
+
+#ifndef VEC2POLY_TILED_H
+#define VEC2POLY_TILED_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <span>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "point.h"
+#include "except.h"
+#include "world.h"
+
+
+struct BadTiles : public Vec2PolyException
+{
+public:
+    BadTiles() noexcept : Vec2PolyException("Bad tiles") {};
+    template<typename PARAM>
+    BadTiles(PARAM &&msg) noexcept : Vec2PolyException(std::forward<PARAM>(msg)) {}
+};
+
+
+/** A map cut into square tiles, which are split into proper paths one at a time.
+ *
+ * Paths are snapped to the grid as they are added, cut where they cross the border of a tile,
+ * and the pieces are spooled to a temporary file, so only the tile being processed is held in memory
+ * (as a world of its own), along with the paths which end on tile borders and must be joined up at the end.
+ *
+ * In grid units, tile (i,j) holds the segments lying within [ic-1/2,(i+1)c-1/2)x[jc-1/2,(j+1)c-1/2)
+ * for a tile size of c grid cells, so no point of the grid is on a border; a path crossing a border
+ * gets a new point there, rounded onto the first row or column of the tile beyond.
+ * Tiles share only those rows and columns, so every intersection is found within a single tile,
+ * except where a path ends on a segment running along a shared row or column in another tile.
+ * Paths are also split at every point they have on a shared row or column; once all tiles are done,
+ * segments along them are split where other paths end, and where exactly two path ends meet,
+ * the paths are joined again (unless a path added ends there).
+ * Peak memory depends on the size of the tiles and on the number of paths ending on their borders.
+ *
+ * Compared with world::proper_paths on the whole map, paths have extra points where they cross a border.
+ * For paths along rows and columns of the grid, those are the only differences; other paths are moved
+ * by up to a grid cell where they cross a border, so near one they can meet other paths differently.
+ * Only proper paths are made this way: polygons are not extracted per tile and stitched across borders,
+ * so making them still needs the proper paths of the whole map in one world.
+ */
+class tiled_map {
+public:
+    /** Receives each proper path, as points in grid units */
+    using sink_t = std::function<void(std::vector<point> const &)>;
+private:
+    /** Tolerance of the grid, as for a world */
+    double tol_;
+    /** Size of a tile, in grid units */
+    point::coord_t cells_;
+    /** Spool of path pieces; each record holds the position of the previous record of the same tile */
+    std::unique_ptr<std::FILE, int(*)(std::FILE *)> spool_;
+    /** Position in the spool of the last record of each tile */
+    std::map<std::pair<std::int64_t, std::int64_t>, long> last_;
+    /** Ends of the paths added which are on shared rows or columns */
+    std::unordered_set<point> ends_;
+
+    /** Tile column or row of a point at v (grid units) */
+    [[nodiscard]] std::int64_t tile_of(point::coord_t v) const noexcept;
+    /** Is v on the first row or column of a tile, which it shares with the tiles before it? */
+    [[nodiscard]] bool on_border(point::coord_t v) const noexcept { return v % cells_ == 0; }
+    [[nodiscard]] bool on_border(point p) const noexcept { return on_border(p.x()) || on_border(p.y()); }
+    void spool(std::pair<std::int64_t, std::int64_t> tile, std::vector<point> const &piece);
+    [[nodiscard]] std::vector<std::vector<point>> unspool(long last);
+    /** A path can end on a segment in another tile which runs along their shared row or column,
+     * where that tile could not split it; split such segments of the open paths */
+    void split_borders(std::vector<std::vector<point>> &open) const;
+    /** Throws BadWorld for the end at q of a line segment which meets no other, as world::branch_points */
+    [[noreturn]] static void unconnected(point q);
+    void join(std::vector<std::vector<point>> &&open, sink_t const &sink) const;
+public:
+    /** @param tol tolerance of the grid, as for a world
+     * @param cells size of a tile, in grid units (at least 2)
+     * Throws BadTiles if the spool cannot be created */
+    tiled_map(double tol, point::coord_t cells);
+
+    /** Add a path through at least two unsnapped points, given as coordinate columns (as world::add_path)
+     * Throws BadPoint if a coordinate loses precision when snapped, or BadTiles if the spool cannot be written */
+    void add_path(std::span<double const> xs, std::span<double const> ys);
+
+    /** Number of tiles holding any paths */
+    [[nodiscard]] std::size_t tiles() const noexcept { return last_.size(); }
+
+    /** Split each tile in turn (as world::split_segments) and make its proper paths (as world::proper_paths),
+     * passing every proper path of the whole map to sink: first those of each tile in turn,
+     * then those joined up across borders.
+     * The tiles are consumed: paths added afterwards start a new map.
+     * Throws BadWorld if a line segment meets no other at one end (as world::branch_points),
+     * which for an end on a shared row or column is only known once all tiles are done.
+     * @param sink receives each proper path
+     * @param method algorithm for finding intersections within a tile
+     */
+    void proper_paths(sink_t const &sink, world::split_method_t method = world::split_method_t::SPLIT_INTERVALS);
+};
+
+
+#endif //VEC2POLY_TILED_H
@@ -16,7 +16,7 @@ bbox::bbox() noexcept
 }
 
 
-void bbox::point(struct point p)
+void bbox::point(::point p)
 {
     if(p.x() < botlx)
         botlx = p.x();
@@ -101,7 +101,7 @@ void debug::end_path()
     std::cerr << "BB ENDPTH\n";
 }
 
-void debug::point(class point p)
+void debug::point(::point p)
 {
     std::cerr << "BB " << p << '\n';
 }
@@ -9,6 +9,7 @@
 #define VEC2POLY_TOPLEVEL_H
 
 
+#include <list>
 #include "world.h"
 #include "graph-path.h"
 #include "polygon.h"
@@ -31,7 +32,7 @@ struct bbox : public alien {
     int botlx, botly, toprx, topry;
     unsigned int npoints;
     bbox() noexcept;
-    void point(class point) override;
+    void point(::point) override;
 };
 
 /** special utility alien for debugging */
@@ -45,7 +46,7 @@ struct debug : public alien {
     void end_poly() override;
     void begin_path() override;
     void end_path() override;
-    void point(class point) override;
+    void point(::point) override;
 };
 
 
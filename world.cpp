@@ -2,40 +2,56 @@
 // Created by jens on 17/09/23.
 //
 
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <numeric>
 #include <set>
+#include <thread>
+#include <tuple>
 #include "world.h"
+#include "snapshot.h"
 
 
 world::iterator &world::iterator::operator++() noexcept
 {
-    /* The dc_ iterator is valid only if the cc_ iterator is not equal to cs_.
-     * Tracking two iterators is complicated, but we need access to the "inner" one.
+    /* dc_ is meaningful only if the cc_ iterator is not equal to cs_.
+     * Tracking both is complicated, but we need access to the "inner" position.
      */
     if(cc_ == cs_)
         return *this;
-    if(++dc_ == ds_)
-        if(cc_ != cs_) {
-            ++cc_;
-            ds_ = cc_->path_.end();
-            dc_ = cc_->path_.begin();
-        }
+    if(++dc_ == cc_->size())
+        if(++cc_ != cs_)
+            dc_ = 0;
     return *this;
 }
 
 
 void world::iterator::insert_after(lineseg &&elt)
 {
-    auto at{dc_};
     /* When we're called dc_ is never at the end and we need to insert at the next position
      * (which may be at the end) without incrementing dc_
      */
-    if(dc_->last() != elt.first())
+    auto &pts = cc_->pts_;
+    if(pts[dc_+1] != elt.first())
         throw BadPath("Start of inserted segment does not match previous");
-    ++at;
-    if(at != ds_ && elt.last() != at->first())
+    if(dc_+2 < pts.size() && elt.last() != pts[dc_+1])
         throw BadPath("End of inserted segment does not match next");
-    cc_->path_.insert(at, std::forward<lineseg>(elt));
+    pts.insert(pts.begin() + static_cast<std::ptrdiff_t>(dc_+2), elt.last());
+}
+
+
+void world::inserter::flush()
+{
+    if(buf_.empty())
+        return;
+    auto lock = w_.alloc_.maybe_lock(*w_.paths_lock_);
+    w_.map_.reserve(w_.map_.size() + buf_.size());
+    std::ranges::move(buf_, std::back_inserter(w_.map_));
+    w_.branch_.reset();
+    buf_.clear();
 }
 
 
@@ -44,54 +60,679 @@ void world::import(std::vector<path> &paths)
     auto s1 = map_.size(), s2 = paths.size();
     map_.reserve(s1+s2);
     for( decltype(s2) j = 0; j < s2; ++j) {
-        // order doesn't matter, though it will copy the paths
-        map_.push_back(paths.back());
+        // order doesn't matter, and only the paths' handles on their points move
+        map_.push_back(std::move(paths.back()));
         paths.pop_back();
     }
+    branch_.reset();
 }
 
 
-void world::split_segments()
+void world::split_segments(split_method_t method, unsigned threads)
 {
-    iterator p = begin();
-    iterator const z = end();
-    /* A pairwise comparison of every line segment with every other one.
-     * The invariant is that every segment up to p intersects any other segments
-     * only at its endpoints, if at all.
-     */
-    while(p != z ) {
-        iterator q = p; ++q;
-        while(q != z ) {
-            auto u{intersects(*p, *q)};
-            if(u.has_value()) {
-                auto v{u.value()};
-                if(!p->is_endpoint(v))
-                    // split_at shortens the current line segment and returns the one to insert
-                    p.insert_after(p->split_at(alloc_,v));
-                if(!q->is_endpoint(v))
-                    q.insert_after(q->split_at(alloc_,v));
+    if(split_ > 0) {
+        split_added();
+        return;
+    }
+    refresh_index();
+    std::optional<std::vector<std::size_t>> starts;
+    // Chains follow the paths, so segments split off since the index was built must be put in place
+    if(method == split_method_t::SPLIT_CHAINS && !(starts = path_starts())) {
+        reset_index();
+        refresh_index();
+        starts = path_starts();
+    }
+    std::vector<lineseg> lines;
+    lines.reserve(segs_.size());
+    for( std::size_t i = 0; i < segs_.size(); ++i )
+        lines.push_back(segment(i));
+    switch(method) {
+    case split_method_t::SPLIT_SWEEP:
+        apply_crossings(sweep_intersections(lines));
+        break;
+    case split_method_t::SPLIT_INTERVALS:
+        apply_crossings(interval_sweep_intersections(lines));
+        break;
+    case split_method_t::SPLIT_INDEX:
+        apply_crossings(index_intersections(lines, index_));
+        break;
+    case split_method_t::SPLIT_TILED:
+        apply_crossings(tiled_intersections(lines, threads));
+        break;
+    case split_method_t::SPLIT_CHAINS:
+        apply_crossings(chain_intersections(lines, *starts));
+        break;
+    case split_method_t::SPLIT_BRUTE:
+        apply_crossings(brute_intersections(lines));
+        break;
+    }
+    split_ = map_.size();
+}
+
+
+void world::split_added()
+{
+    if(split_ == map_.size())
+        return;
+    refresh_index();
+    // The segments of paths added since the split were indexed after all the others,
+    // so they are at the end of segs_
+    auto first = segs_.size();
+    while(first > 0 && segs_[first-1].first >= split_)
+        --first;
+    auto const last = segs_.size();
+    std::vector<crossing> cross;
+    for( std::size_t i = first; i < last; ++i )
+        index_.query(segbox(segment(i), i), [this,&cross,first,i](std::size_t j)
+        {
+            // Pairs of new segments are found from both ends, so only test them from the first
+            if(j >= first && j <= i)
+                return;
+            // Test in index order, as the other engines do
+            auto const [i0, i1] = std::minmax(i, j);
+            lineseg const v = segment(i0), w = segment(i1);
+            auto const u = intersects(v, w);
+            if(!u)
+                return;
+            if(!v.is_endpoint(*u))
+                cross.push_back({i0, *u});
+            if(!w.is_endpoint(*u))
+                cross.push_back({i1, *u});
+        });
+    apply_crossings(std::move(cross));
+    split_ = map_.size();
+}
+
+
+void world::refresh_index() const
+{
+    if(index_.stale())
+        index_.repack();
+    if(indexed_ == map_.size())
+        return;
+    std::vector<segbox> boxes;
+    for( ; indexed_ < map_.size(); ++indexed_ ) {
+        path const &p = map_[indexed_];
+        auto &ids = ids_.emplace_back();
+        ids.reserve(p.size());
+        for( std::size_t k = 0; k < p.size(); ++k ) {
+            boxes.emplace_back(p[k], segs_.size());
+            ids.push_back(segs_.size());
+            segs_.emplace_back(indexed_, k);
+        }
+    }
+    // Bulk build the first time, or when more than doubling the index
+    if(boxes.size() > index_.size()) {
+        for( std::size_t i = 0; i < segs_.size() - boxes.size(); ++i )
+            boxes.emplace_back(segment(i), i);
+        index_.build(std::move(boxes));
+    } else {
+        for( segbox const &b : boxes )
+            index_.insert(b);
+        if(index_.stale())
+            index_.repack();
+    }
+}
+
+
+std::optional<std::vector<std::size_t>> world::path_starts() const
+{
+    std::vector<std::size_t> starts;
+    starts.reserve(map_.size());
+    std::size_t k = 0;
+    for( path const &p : map_ ) {
+        starts.push_back(k);
+        for( std::size_t s = 0; s < p.size(); ++s, ++k )
+            if(k >= segs_.size() || segs_[k] != segpos(starts.size()-1, s))
+                return std::nullopt;
+    }
+    return starts;
+}
+
+
+void world::reset_index() noexcept
+{
+    index_.clear();
+    segs_.clear();
+    ids_.clear();
+    indexed_ = 0;
+}
+
+
+void world::apply_crossings(std::vector<crossing> &&cross)
+{
+    // Sort crossings by segment, and then by distance from the start of the segment,
+    // so each segment can be split from its start to its end
+    auto along = [this](crossing const &c) -> double
+    {
+        pathpoint a = segment(c.seg).first();
+        double const dx = c.at.x()-a->x(), dy = c.at.y()-a->y();
+        return dx*dx+dy*dy;
+    };
+    std::vector<std::pair<double,crossing>> sorted;
+    sorted.reserve(cross.size());
+    for( crossing const &c : cross )
+        sorted.emplace_back(along(c), c);
+    // Ties are broken by coordinates so the result does not depend on the order crossings were found in
+    std::ranges::sort(sorted, [](auto const &l, auto const &r)
+    {
+        auto key = [](auto const &y) { return std::tuple(y.second.seg, y.first, y.second.at.x(), y.second.at.y()); };
+        return key(l) < key(r);
+    });
+    // Drop the crossings which need no split: the same point may be found twice,
+    // or be an endpoint of the segment already
+    auto const kept = std::ranges::unique(sorted, [](auto const &l, auto const &r)
+    {
+        return l.second.seg == r.second.seg && l.second.at == r.second.at;
+    });
+    sorted.erase(kept.begin(), kept.end());
+    std::erase_if(sorted, [this](auto const &y) { return segment(y.second.seg).is_endpoint(y.second.at); });
+    // Make the new points exactly where the crossings are, as lineseg::split_at does:
+    // they are on the grid already, and snapping (which may be Euclidean) could move one onto
+    // an endpoint or another crossing of the same segment, which were filtered out above
+    std::vector<pathpoint> pts;
+    pts.reserve(sorted.size());
+    for( auto const &y : sorted )
+        pts.push_back(alloc_.make_point(y.second.at));
+    if(!pts.empty())
+        branch_.reset();
+    // Then split each path once, at all its points, in order along it
+    std::vector<std::size_t> order(sorted.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::sort(order, {}, [this,&sorted](std::size_t i) { return std::pair(segs_[sorted[i].second.seg], i); });
+    std::vector<std::pair<std::size_t, pathpoint>> at;
+    for( std::size_t c = 0; c < order.size(); ) {
+        auto const p = segs_[sorted[order[c]].second.seg].first;
+        at.clear();
+        for( ; c < order.size() && segs_[sorted[order[c]].second.seg].first == p; ++c )
+            at.emplace_back(segs_[sorted[order[c]].second.seg].second, pts[order[c]]);
+        map_[p].split_at(alloc_, at);
+        // Segments after a split point have moved up the path, and the new ones need numbers.
+        // The shortened segments stay within their old boxes in the index, so only the new ones are added
+        auto &ids = ids_[p];
+        auto const fresh = segs_.size();
+        std::vector<std::size_t> moved;
+        moved.reserve(ids.size() + at.size());
+        auto a = at.cbegin();
+        for( std::size_t k = 0; k < ids.size(); ++k ) {
+            moved.push_back(ids[k]);
+            for( ; a != at.cend() && a->first == k; ++a ) {
+                moved.push_back(segs_.size());
+                segs_.emplace_back(p, 0);
             }
-            ++q;
         }
-        ++p;
+        ids = std::move(moved);
+        for( std::size_t k = 0; k < ids.size(); ++k ) {
+            segs_[ids[k]].second = k;
+            if(ids[k] >= fresh)
+                index_.insert(segbox(map_[p][k], ids[k]));
+        }
+    }
+}
+
+
+std::vector<pathpoint> const &world::branch_points()
+{
+    if(branch_)
+        return *branch_;
+    std::vector<pathpoint> result;
+    pointid_t id{0};
+    // Scan the use counts column by column rather than visiting each point
+    for( std::span<unsigned const> counts : alloc_.use_counts() ) {
+        // The common case is no unconnected segments, checked as one vectorisable pass
+        auto bad = std::ranges::find(counts, 1u);
+        if(bad != counts.end()) {
+            std::ostringstream msg;
+            msg << "Unconnected line segment found at " << alloc_.at(id + (bad - counts.begin()));
+            throw BadWorld(msg.view());
+        }
+        for( unsigned const c : counts ) {
+            if(c > 2)
+                result.push_back(alloc_.at(id));
+            ++id;
+        }
     }
+    return branch_.emplace(std::move(result));
 }
 
 
-void world::proper_paths(std::vector<point> bps)
+void world::proper_paths(std::vector<point> bps, unsigned threads)
 {
     if(map_.empty()) return;
-    // Proper paths begin and end in branch points
-    // Collapse the view into a vector, as in views.to(...) from C++23
-    // (sets don't work with points, at least not out of the box)
+    // Proper paths begin and end in branch points.
+    // Mark the points to split at by id, so each point on a path is checked in constant time
+    std::vector<bool> cut(alloc_.size());
     if(bps.empty())
-        for( auto y: branch_points() )
-            bps.push_back(*y);
-    std::vector<path> results;
+        for( pathpoint y : branch_points() )
+            cut[y->id()] = true;
+    else
+        for( point y : bps )
+            if(auto const id = alloc_.lookup(y); id >= 0)
+                cut[static_cast<std::size_t>(id)] = true;
+    // Each path is split on its own, so blocks of paths are split in parallel, each thread taking
+    // the next block not yet done.  New paths are gathered per block and merged in block order,
+    // so the result does not depend on the threads.
     // Iterators are not invalidated as we gather results before adding them
-    for( path &p : map_ )
-        p.split_path(results, bps);
+    constexpr std::size_t block = 256;
+    auto const blocks = (map_.size() + block - 1) / block;
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, blocks));
+    std::vector<std::vector<path>> found(blocks);
+    std::atomic<std::size_t> next{0};
+    auto work = [&]()
+    {
+        for(std::size_t b = next++; b < blocks; b = next++)
+            for(auto k = b * block; k < std::min(map_.size(), (b+1) * block); ++k)
+                map_[k].split_path(found[b], cut);
+    };
+    {
+        std::vector<std::jthread> pool;
+        for(unsigned k = 1; k < threads; ++k)
+            pool.emplace_back(work);
+        work();
+    }
+    std::vector<path> results;
+    results.reserve(std::accumulate(found.begin(), found.end(), std::size_t{0},
+                                    [](std::size_t n, auto const &f) { return n + f.size(); }));
+    for(auto &f : found)
+        std::ranges::move(f, std::back_inserter(results));
+    // Segments have moved between paths, so the world is only still split if all of it was
+    bool const split = split_ == map_.size();
+    reset_index();
     import(results);
+    split_ = split ? map_.size() : 0;
+}
+
+
+std::size_t world::simplify(double cells)
+{
+    std::size_t dropped = 0;
+    for( path &p : map_ )
+        dropped += p.simplify(alloc_, cells);
+    if(dropped > 0) {
+        // Line segments have changed, so they need indexing and splitting again
+        reset_index();
+        split_ = 0;
+    }
+    return dropped;
+}
+
+
+world::clean_counts world::clean()
+{
+    clean_counts removed{0, 0, 0};
+    // A segment adds a use to each of its ends, which goes when it is removed
+    auto drop = [this](pathpoint a, pathpoint b) { alloc_.decf(a); alloc_.decf(b); };
+
+    // Zero length segments, which may leave a path with a single point, which goes too
+    std::vector<path> kept;
+    kept.reserve(map_.size());
+    for( path &p : map_ ) {
+        auto &pts = p.pts_;
+        std::size_t m = 1;
+        for( std::size_t k = 1; k < pts.size(); ++k )
+            if(pts[k] == pts[m-1]) {
+                drop(pts[k], pts[k]);
+                ++removed.zero_length;
+            } else
+                pts[m++] = pts[k];
+        pts.resize(m);
+        if(m > 1)
+            kept.push_back(std::move(p));
+    }
+    map_ = std::move(kept);
+
+    // Duplicate paths, found by the hash of the point ids of each path, in a canonical order:
+    // the smaller of the two directions, and for a loop, starting from its smallest id
+    auto canonical = [](path const &p)
+    {
+        std::vector<pointid_t> ids;
+        ids.reserve(p.pts_.size());
+        for( pathpoint q : p.pts_ )
+            ids.push_back(q->id());
+        if(ids.front() != ids.back()) {
+            if(std::ranges::lexicographical_compare(ids.rbegin(), ids.rend(), ids.begin(), ids.end()))
+                std::ranges::reverse(ids);
+            return ids;
+        }
+        // A loop may pass its smallest point more than once, so try each start
+        ids.pop_back();
+        auto const n = ids.size();
+        auto const least = std::ranges::min(ids);
+        std::vector<pointid_t> best, turn(n+1);
+        for( std::size_t s = 0; s < n; ++s )
+            if(ids[s] == least)
+                for( int dir : {1, -1} ) {
+                    for( std::size_t k = 0; k <= n; ++k )
+                        turn[k] = ids[(s + (dir > 0 ? k : n - k % n)) % n];
+                    if(best.empty() || turn < best)
+                        best = turn;
+                }
+        return best;
+    };
+    std::vector<std::vector<pointid_t>> keys;
+    keys.reserve(map_.size());
+    std::vector<std::pair<std::size_t, std::size_t>> hashes;
+    hashes.reserve(map_.size());
+    for( path const &p : map_ ) {
+        auto const &key = keys.emplace_back(canonical(p));
+        std::size_t h = key.size();
+        for( pointid_t id : key )
+            h ^= std::hash<pointid_t>{}(id) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        hashes.emplace_back(h, hashes.size());
+    }
+    std::ranges::sort(hashes);
+    std::vector<bool> dup(map_.size());
+    for( std::size_t i = 0; i < hashes.size(); ) {
+        auto j = i;
+        for( ; j < hashes.size() && hashes[j].first == hashes[i].first; ++j )
+            // Paths with the same hash are compared with the earlier ones, which are kept
+            for( auto k = i; k < j; ++k )
+                if(!dup[hashes[k].second] && keys[hashes[k].second] == keys[hashes[j].second]) {
+                    dup[hashes[j].second] = true;
+                    break;
+                }
+        i = j;
+    }
+    keys.clear();
+    for( std::size_t e = 0; e < map_.size(); ++e )
+        if(dup[e]) {
+            for( lineseg const s : map_[e] )
+                drop(s.first(), s.last());
+            ++removed.duplicate_paths;
+        }
+    std::erase_if(map_, [&dup, e = std::size_t{0}](path const &) mutable { return dup[e++]; });
+
+    // Collinear segments are on the same line, given by the direction between their ends
+    // (divided by their gcd, and pointing right or up) and the offset of the line from the origin;
+    // points are ordered along the line by their projection onto the direction.
+    // Snapped coordinates are less than 2^53, so these fit in 128 bits (as in orient_exact)
+    using wide = __int128;
+    struct along {
+        std::tuple<point::coord_t, point::coord_t, wide> line;
+        /** Projections of the ends, from the lower to the higher, and their points */
+        wide from, to;
+        pathpoint lo, hi;
+        /** Segment k of path e */
+        std::size_t e, k;
+    };
+    std::vector<along> segs;
+    for( std::size_t e = 0; e < map_.size(); ++e )
+        for( std::size_t k = 0; k < map_[e].size(); ++k ) {
+            pathpoint a = map_[e].pts_[k], b = map_[e].pts_[k+1];
+            auto dx = b->x() - a->x(), dy = b->y() - a->y();
+            auto const g = std::gcd(dx, dy);
+            dx /= g;
+            dy /= g;
+            if(dx < 0 || (dx == 0 && dy < 0)) {
+                dx = -dx;
+                dy = -dy;
+            }
+            auto proj = [dx, dy](pathpoint q) { return static_cast<wide>(dx) * q->x() + static_cast<wide>(dy) * q->y(); };
+            wide const offset = static_cast<wide>(dx) * a->y() - static_cast<wide>(dy) * a->x();
+            if(proj(a) > proj(b))
+                std::swap(a, b);
+            segs.push_back({{dx, dy, offset}, proj(a), proj(b), a, b, e, k});
+        }
+    std::ranges::sort(segs, [](along const &l, along const &r) { return std::tie(l.line, l.from) < std::tie(r.line, r.from); });
+    // On each line where segments overlap, split each segment at the ends of the others within it,
+    // so overlapping pieces have the same ends.  Splits are listed by path and segment, in order along it
+    std::vector<std::tuple<std::size_t, std::size_t, std::size_t, pathpoint>> splits;
+    std::vector<std::pair<wide, pathpoint>> ends;
+    for( std::size_t i = 0; i < segs.size(); ) {
+        auto j = i+1;
+        bool overlap = false;
+        for( wide reach = segs[i].to; j < segs.size() && segs[j].line == segs[i].line; ++j ) {
+            overlap = overlap || segs[j].from < reach;
+            reach = std::max(reach, segs[j].to);
+        }
+        if(overlap) {
+            ends.clear();
+            for( auto k = i; k < j; ++k ) {
+                ends.emplace_back(segs[k].from, segs[k].lo);
+                ends.emplace_back(segs[k].to, segs[k].hi);
+            }
+            std::ranges::sort(ends, {}, &std::pair<wide, pathpoint>::first);
+            auto const same = std::ranges::unique(ends, {}, &std::pair<wide, pathpoint>::first);
+            ends.erase(same.begin(), same.end());
+            for( auto k = i; k < j; ++k ) {
+                along const &s = segs[k];
+                auto const lo = std::ranges::upper_bound(ends, s.from, {}, &std::pair<wide, pathpoint>::first);
+                auto const hi = std::ranges::lower_bound(ends, s.to, {}, &std::pair<wide, pathpoint>::first);
+                bool const forward = map_[s.e].pts_[s.k] == s.lo;
+                for( auto y = lo; y != hi; ++y )
+                    splits.emplace_back(s.e, s.k, static_cast<std::size_t>(forward ? y - lo : hi - y), y->second);
+            }
+        }
+        i = j;
+    }
+    segs.clear();
+    std::ranges::sort(splits, [](auto const &l, auto const &r)
+    {
+        return std::tie(std::get<0>(l), std::get<1>(l), std::get<2>(l)) < std::tie(std::get<0>(r), std::get<1>(r), std::get<2>(r));
+    });
+    std::vector<std::pair<std::size_t, pathpoint>> at;
+    for( std::size_t c = 0; c < splits.size(); ) {
+        auto const e = std::get<0>(splits[c]);
+        at.clear();
+        for( ; c < splits.size() && std::get<0>(splits[c]) == e; ++c ) {
+            // The point is already used; split_at counts one of its two new uses
+            alloc_.incf(std::get<3>(splits[c]));
+            at.emplace_back(std::get<1>(splits[c]), std::get<3>(splits[c]));
+        }
+        map_[e].split_at(alloc_, at);
+    }
+
+    // Now overlapping pieces join the same points, and all but the first are removed.
+    // This finds any segment drawn twice, whether or not it had to be split
+    std::vector<std::tuple<pointid_t, pointid_t, std::size_t, std::size_t>> pairs;
+    for( std::size_t e = 0; e < map_.size(); ++e )
+        for( std::size_t k = 0; k < map_[e].size(); ++k ) {
+            auto const a = map_[e].pts_[k]->id(), b = map_[e].pts_[k+1]->id();
+            pairs.emplace_back(std::min(a, b), std::max(a, b), e, k);
+        }
+    std::ranges::sort(pairs);
+    std::vector<std::vector<bool>> gone(map_.size());
+    for( std::size_t i = 1; i < pairs.size(); ++i )
+        if(std::get<0>(pairs[i]) == std::get<0>(pairs[i-1]) && std::get<1>(pairs[i]) == std::get<1>(pairs[i-1])) {
+            auto const [u, v, e, k] = pairs[i];
+            if(gone[e].empty())
+                gone[e].resize(map_[e].size());
+            gone[e][k] = true;
+            drop(map_[e].pts_[k], map_[e].pts_[k+1]);
+            ++removed.overlaps;
+        }
+    pairs.clear();
+    // Paths are split where segments were removed
+    if(removed.overlaps > 0) {
+        std::vector<path> result;
+        result.reserve(map_.size());
+        for( std::size_t e = 0; e < map_.size(); ++e ) {
+            if(gone[e].empty()) {
+                result.push_back(std::move(map_[e]));
+                continue;
+            }
+            auto const &pts = map_[e].pts_;
+            for( std::size_t k = 0; k < gone[e].size(); ) {
+                if(gone[e][k]) {
+                    ++k;
+                    continue;
+                }
+                auto const from = k;
+                while(k < gone[e].size() && !gone[e][k])
+                    ++k;
+                path p;
+                p.pts_.assign(pts.begin() + static_cast<std::ptrdiff_t>(from), pts.begin() + static_cast<std::ptrdiff_t>(k) + 1);
+                result.push_back(std::move(p));
+            }
+        }
+        map_ = std::move(result);
+    }
+
+    if(removed.zero_length + removed.duplicate_paths + removed.overlaps + splits.size() > 0) {
+        // Paths have changed, so they need indexing and splitting again
+        reset_index();
+        branch_.reset();
+        split_ = 0;
+    }
+    return removed;
+}
+
+
+/** Position of (x,y) along the Hilbert curve through a grid of 2^order by 2^order cells */
+static std::uint64_t hilbert_key(std::uint32_t x, std::uint32_t y, unsigned order) noexcept
+{
+    std::uint64_t d = 0;
+    for( std::uint32_t s = order ? 1u << (order-1) : 0; s > 0; s >>= 1 ) {
+        std::uint32_t const rx = (x & s) ? 1 : 0, ry = (y & s) ? 1 : 0;
+        d += static_cast<std::uint64_t>(s) * s * ((3 * rx) ^ ry);
+        // Turn the quadrant round, so the curve runs through it the same way as through the whole grid
+        if(ry == 0) {
+            if(rx == 1) {
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+
+void world::hilbert_order()
+{
+    auto const n = alloc_.size();
+    if(n == 0)
+        return;
+    // Points are placed on a grid of at most 2^32 by 2^32 cells covering them all
+    auto const xs = alloc_.xs(), ys = alloc_.ys();
+    auto const [x0, x1] = std::ranges::minmax(xs);
+    auto const [y0, y1] = std::ranges::minmax(ys);
+    // Differences of coordinates need not fit in a coordinate (with VEC2POLY_COORD32)
+    auto const span = static_cast<std::uint64_t>(std::max(std::int64_t{x1} - x0, std::int64_t{y1} - y0));
+    auto const order = static_cast<unsigned>(std::bit_width(span));
+    auto const shift = order > 32 ? order - 32 : 0;
+    std::vector<std::pair<std::uint64_t, pointid_t>> keys(n);
+    for( pointid_t id = 0; id < n; ++id ) {
+        auto const x = static_cast<std::uint32_t>(static_cast<std::uint64_t>(std::int64_t{xs[id]} - x0) >> shift);
+        auto const y = static_cast<std::uint32_t>(static_cast<std::uint64_t>(std::int64_t{ys[id]} - y0) >> shift);
+        keys[id] = {hilbert_key(x, y, order - shift), id};
+    }
+    std::ranges::sort(keys);
+
+    // Make the points again in that order, with the same use counts
+    pntalloc fresh(alloc_.tol(), alloc_.concurrent());
+    fresh.snapping(alloc_.snapping());
+    std::vector<pathpoint> moved(n);
+    for( auto const &[_, id] : keys ) {
+        pathpoint const old = alloc_.at(id);
+        pathpoint const p = fresh.make_point(point(*old));
+        fresh.counts_[p->id()] = alloc_.use_count(old);
+        moved[id] = p;
+    }
+    for( path &p : map_ )
+        for( pathpoint &q : p.pts_ )
+            q = moved[q->id()];
+    alloc_ = std::move(fresh);
+
+    // Paths in order of their endpoints, so paths meeting at a point are together
+    auto ends = [](path const &p)
+    {
+        auto const a = p.pts_.front()->id(), b = p.pts_.back()->id();
+        return std::pair(std::min(a, b), std::max(a, b));
+    };
+    auto const split = map_.begin() + static_cast<std::ptrdiff_t>(split_);
+    std::ranges::stable_sort(map_.begin(), split, {}, ends);
+    std::ranges::stable_sort(split, map_.end(), {}, ends);
+    reset_index();
+    branch_.reset();
+}
+
+
+world::world(snapshot const &snap) : world(snap.tol())
+{
+    auto const n = snap.points();
+    // The points were distinct when written, so they get the same ids again.
+    // They are loaded straight from the mapped columns, and only hashed into the index if it is used
+    alloc_.load(snap.xs(), snap.ys());
+    map_.reserve(snap.paths());
+    for(std::size_t k = 0; k < snap.paths(); ++k) {
+        auto const ids = snap.path(k);
+        path p;
+        p.pts_.reserve(ids.size());
+        for(std::size_t m = 0; m < ids.size(); ++m) {
+            if(ids[m] >= n)
+                throw BadSnapshot("Snapshot path refers to a point not in the snapshot");
+            // Every point is counted once per segment end; points on no path keep no uses (see simplify)
+            alloc_.counts_[ids[m]] += (m == 0 || m+1 == ids.size()) ? 1 : 2;
+            p.pts_.push_back(alloc_.at(static_cast<pointid_t>(ids[m])));
+        }
+        map_.push_back(std::move(p));
+    }
+    std::vector<pathpoint> branch;
+    auto const flags = snap.branch();
+    for(std::size_t id = 0; id < n; ++id)
+        if(flags[id])
+            branch.push_back(alloc_.at(static_cast<pointid_t>(id)));
+    branch_.emplace(std::move(branch));
+    split_ = snap.split();
+}
+
+
+void world::write_snapshot(std::string const &filename) const
+{
+    snapshot_header h{};
+    std::memcpy(h.magic, "vec2poly", sizeof(h.magic));
+    h.version = snapshot::version;
+    h.order = 1;
+    h.tol = alloc_.tol();
+    h.points = alloc_.size();
+    h.paths = map_.size();
+    h.vertices = 0;
+    for(path const &p : map_)
+        h.vertices += p.pts_.size();
+    h.split = split_;
+    auto align = [](std::uint64_t offset) { return (offset + 7) & ~std::uint64_t{7}; };
+    h.xs = align(sizeof(h));
+    h.ys = h.xs + h.points * sizeof(std::int64_t);
+    h.branch = h.ys + h.points * sizeof(std::int64_t);
+    h.starts = align(h.branch + h.points);
+    h.ids = h.starts + (h.paths + 1) * sizeof(std::uint64_t);
+
+    std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+    auto write = [&os](auto const &v)
+    {
+        os.write(reinterpret_cast<char const *>(v.data()), static_cast<std::streamsize>(v.size() * sizeof(v[0])));
+    };
+    auto pad = [&os](std::uint64_t to)
+    {
+        while(static_cast<std::uint64_t>(os.tellp()) < to)
+            os.put('\0');
+    };
+    os.write(reinterpret_cast<char const *>(&h), sizeof(h));
+    pad(h.xs);
+    write(std::vector<std::int64_t>(alloc_.xs().begin(), alloc_.xs().end()));
+    write(std::vector<std::int64_t>(alloc_.ys().begin(), alloc_.ys().end()));
+    std::vector<std::uint8_t> branch;
+    branch.reserve(h.points);
+    for(auto const &counts : alloc_.use_counts())
+        for(unsigned const c : counts)
+            branch.push_back(c > 2);
+    write(branch);
+    pad(h.starts);
+    std::vector<std::uint64_t> starts{0}, ids;
+    starts.reserve(h.paths + 1);
+    ids.reserve(h.vertices);
+    for(path const &p : map_) {
+        for(pathpoint q : p.pts_)
+            ids.push_back(q->id());
+        starts.push_back(ids.size());
+    }
+    write(starts);
+    write(ids);
+    if(!os)
+        throw BadSnapshot("Cannot write snapshot " + filename);
 }
 
 
@@ -7,11 +7,16 @@
 
 #include <vector>
 #include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <ranges>
 #include <sstream>
 #include "lineseg.h"
 #include "pntalloc.h"
 #include "except.h"
+#include "intersect.h"
+#include "segindex.h"
 
 
 struct BadWorld : public Vec2PolyException
@@ -25,6 +30,8 @@ public:
 
 // defined in polygon.cpp
 class path_lookup;
+// defined in snapshot.h
+class snapshot;
 
 
 /** World - the home of all paths
@@ -40,25 +47,42 @@ private:
     /* Point factory */
     pntalloc alloc_;
 
+    /** In concurrent mode, serialises adding paths to map_ */
+    std::unique_ptr<std::mutex> paths_lock_;
+
+    /** Position of a line segment: the index of its path in map_ and its index in the path */
+    using segpos = std::pair<std::size_t, std::size_t>;
+
+    /** Spatial index of line segments, numbered as in segs_.
+     * It is brought up to date when queried (see refresh_index), so it is mutable;
+     * like the rest of world, it is not safe to query from several threads at once */
+    mutable segindex index_;
+    /** Position of each line segment in the index */
+    mutable std::vector<segpos> segs_;
+    /** Number in the index of each line segment of each indexed path, in order along the path
+     * (the inverse of segs_, so positions can be updated when a path is split) */
+    mutable std::vector<std::vector<std::size_t>> ids_;
+    /** Number of paths in map_ whose line segments are in the index (the rest are added when queried) */
+    mutable std::size_t indexed_;
+    /** Branch points, in order of point id, if known since use counts last changed (see branch_points) */
+    std::optional<std::vector<pathpoint>> branch_;
+    /** Number of paths at the start of map_ which have been split, so their line segments meet
+     * each other only at endpoints; paths added since are split incrementally (see split_added) */
+    std::size_t split_;
+
     /** Iterator over all line segments in all paths in the world.
      *
-     * This iterator works like ranges::views::join, but we need both iterators
-     * so we can insert stuff at the list iterator position (which does not
-     * invalidate the iterator).
+     * This iterator works like ranges::views::join, but we need both the path
+     * and the position in it so we can insert stuff at the position (which,
+     * being an index, is not invalidated by inserting).
      * Otherwise, this approach is not recommended; much too fiddly.
      * Correctness is helped also by the fact that paths are never empty. */
     struct iterator {
         // current position and sentinel
         std::vector<path>::iterator cc_, cs_;
-        decltype(path::path_)::iterator dc_, ds_;
+        std::size_t dc_;
 
-        iterator(decltype(map_) &m, bool begin = true): cc_(begin ? m.begin() : m.end()), cs_(m.end())
-        {
-            if(m.begin() != cs_) {
-                ds_ = cc_->path_.end();
-                dc_ = begin ? cc_->path_.begin() : ds_;
-            }
-        }
+        iterator(decltype(map_) &m, bool begin = true): cc_(begin ? m.begin() : m.end()), cs_(m.end()), dc_(0) {}
         iterator &operator++() noexcept;
         iterator operator++(int) noexcept { auto i{*this}; ++(*this); return i; }
         bool operator==(const iterator &other)
@@ -68,47 +92,170 @@ private:
              * or one iterator has been invalidated. */
             if(cc_ != other.cc_)
                 return false;
-            /* dc_ iterator is valid only if cc_ is not equal to cs_ */
+            /* dc_ is meaningful only if cc_ is not equal to cs_ */
             if(cc_ == cs_)
                 return other.cc_ == other.cs_;
             else if(other.cc_ == other.cs_)
                 return false;
             return dc_ == other.dc_;
         }
-        auto &operator*() { return *dc_; }
-        auto *operator->() { return &(*dc_); }
+        lineseg operator*() const { return (*cc_)[dc_]; }
 
         /** Insert a line segment _after_ the current one.
          *
          * Insertion does not validate the iterator, though add_path may.
          * It is not possible to insert at beginning (with this call).
+         * The inserted segment is not added to the spatial index (see reset_index).
          * */
         void insert_after(lineseg &&);
     };
     iterator begin() { return iterator(map_); }
     iterator end() { return iterator(map_, false); }
 
+    /** Add the line segments of paths added since the index was last used.
+     * The first time, the index is bulk built from all the segments */
+    void refresh_index() const;
+    /** Forget the index, as paths have been rearranged */
+    void reset_index() noexcept;
+    /** Line segment number i in the index */
+    lineseg segment(std::size_t i) const { return map_[segs_[i].first][segs_[i].second]; }
+    /** Where each path's first line segment is in segs_, if segs_ lists the segments of all paths in order along them */
+    std::optional<std::vector<std::size_t>> path_starts() const;
+
+    /** Split line segments at the crossings found for them (segments are numbered as in segs_).
+     * The new points are made in one batch, and each segment is split once, at all its crossings */
+    void apply_crossings(std::vector<crossing> &&cross);
+    /** Split the paths added since the world was split, against each other and the split paths.
+     * Each new segment is looked up in the spatial index, so this is O(M log N) for M new segments */
+    void split_added();
+
 public:
 
-    world(double tol) : map_(), alloc_(tol) {}
+    /** Create an empty world.
+     * @param tol grid size for snapping points
+     * @param concurrent whether paths will be added from several threads at once
+     */
+    world(double tol, bool concurrent = false) : map_(), alloc_(tol, concurrent), paths_lock_(std::make_unique<std::mutex>()),
+        index_(), segs_(), ids_(), indexed_(0), branch_(), split_(0) {}
+    /** Restore a world from a snapshot (see write_snapshot), with the same points, paths and use counts.
+     * The points are only hashed into the point factory's index when it is first used (see pntalloc::load).
+     * Throws BadSnapshot if a path refers to a point not in the snapshot */
+    explicit world(snapshot const &snap);
     world(world const &) = delete;
     world(world &&) = default;
     world &operator=(world const &) = delete;
     world &operator=(world &&) = default;
 
-    void add_path(path &&p) { map_.emplace_back(std::forward<path>(p)); }
-    void add_path(std::initializer_list<point> const &p)
+    /* In concurrent mode, paths can be added from several threads at once.
+     * The paths (and their points) are built before taking the lock. */
+    void add_path(path &&p)
     {
-        map_.emplace_back(alloc_, p);
+        auto lock = alloc_.maybe_lock(*paths_lock_);
+        map_.emplace_back(std::forward<path>(p));
+        branch_.reset();
     }
+    void add_path(std::initializer_list<point> const &p) { add_path(path(alloc_, p)); }
+    /** Add a path through unsnapped coordinates, as read from a file */
+    void add_path(std::span<double const> xs, std::span<double const> ys) { add_path(path(alloc_, xs, ys)); }
+
+    /** Per-thread buffer for adding paths to a concurrent world.
+     *
+     * Paths are built in the buffer, sharing the world's point factory, and
+     * moved into the world in one go when the buffer is flushed or destroyed,
+     * so threads contend for the world's path list only once per flush.
+     */
+    class inserter {
+        world &w_;
+        std::vector<path> buf_;
+    public:
+        explicit inserter(world &w) : w_(w), buf_() {}
+        inserter(inserter const &) = delete;
+        inserter &operator=(inserter const &) = delete;
+        ~inserter() { flush(); }
+
+        void add_path(std::initializer_list<point> const &p) { buf_.emplace_back(w_.alloc_, p); }
+        void add_path(std::span<double const> xs, std::span<double const> ys) { buf_.emplace_back(w_.alloc_, xs, ys); }
+
+        /** Move the buffered paths into the world */
+        void flush();
+    };
     /** Import paths by moving them */
     void import(std::vector<path> &);
 
-    /** Split line segments at intersection points */
-    void split_segments();
+    /** Algorithm for finding intersections between line segments */
+    enum class split_method_t {
+        /** Compare every segment with every other one: O(N^2) */
+        SPLIT_BRUTE,
+        /** Sweep a line across the segments, keeping them in order along it (see sweep_intersections) */
+        SPLIT_SWEEP,
+        /** Sweep a line across the segments' x intervals (see interval_sweep_intersections) */
+        SPLIT_INTERVALS,
+        /** Look up nearby segments in the world's spatial index (see index_intersections) */
+        SPLIT_INDEX,
+        /** Sweep spatial tiles on several threads (see tiled_intersections) */
+        SPLIT_TILED,
+        /** Sweep monotone chains of segments (see chain_intersections) */
+        SPLIT_CHAINS
+    };
+
+    /** Split line segments at intersection points.
+     * All methods give exactly the same world, as they find the same intersections
+     * on the unsplit segments before splitting any of them.
+     * Once the world is split, paths added later are split incrementally when this is
+     * called again, whatever the method: only the new segments are looked up in the
+     * spatial index, and existing segments they cross are split in place.
+     * @param method algorithm for finding intersections
+     * @param threads number of threads for SPLIT_TILED (0 for one per core)
+     */
+    void split_segments(split_method_t method = split_method_t::SPLIT_BRUTE, unsigned threads = 0);
     /** Reorder paths into proper paths by ensuring endpoints in the set bps
-     * Default (if bps is empty) is to use the branch points */
-    void proper_paths(std::vector<point> bps = {});
+     * Default (if bps is empty) is to use the branch points.
+     * Paths are split in parallel; the resulting paths are the same, in the same order,
+     * whatever the number of threads
+     * @param threads number of threads (0 for one per core)
+     */
+    void proper_paths(std::vector<point> bps = {}, unsigned threads = 0);
+    /** Simplify every path (see path::simplify), keeping endpoints and points shared with other paths.
+     * This is meant to be run before split_segments, to drop points which are not needed;
+     * if it is run after, the world must be split again in full.
+     * @param cells distance within which points are dropped, in grid units (multiples of the tolerance)
+     * @return the number of points dropped
+     */
+    std::size_t simplify(double cells = 1.0);
+
+    /** What clean removed */
+    struct clean_counts {
+        /** Line segments from a point to itself */
+        std::size_t zero_length;
+        /** Paths through the same points as an earlier path, in either direction (and from any point of a loop) */
+        std::size_t duplicate_paths;
+        /** Line segments, or pieces of them, lying along an earlier one */
+        std::size_t overlaps;
+    };
+    /** Remove degenerate and duplicate line segments, as snapping points to the grid makes them:
+     * zero length segments, paths drawn twice, and collinear segments which overlap,
+     * which are split where the other's endpoints are, so only one copy of each piece is kept
+     * (this also removes a path going back on itself).  Paths are split where pieces are removed.
+     * Meant to be run before split_segments, which does not detect overlaps;
+     * if it is run after, the world must be split again in full.  O(N log N) for N line segments,
+     * unless many collinear segments overlap each other.
+     * @return counts of what was removed
+     */
+    clean_counts clean();
+
+    /** Renumber the points, and reorder the paths, along a Hilbert curve through the points,
+     * so points near each other, and the paths meeting at them, are near each other in memory.
+     * Graph nodes and edges are numbered in the order of the paths (see graph), so they follow too.
+     * Paths are ordered by the numbers of their endpoints; split paths stay ahead of the rest (see split_segments).
+     * Meant to be run after proper_paths and before making the graph: every pathpoint held outside
+     * the world refers to the old points, which are gone.
+     */
+    void hilbert_order();
+
+    /** Write a snapshot of the world, typically after split_segments and proper_paths,
+     * so later runs can start from there (see snapshot).
+     * Throws BadSnapshot if the file cannot be written */
+    void write_snapshot(std::string const &filename) const;
 
     /** Iterator over all line segments */
     auto segments() { return std::ranges::views::join(map_); }
@@ -116,28 +263,48 @@ public:
     /** Iterate over all paths */
     auto paths() const { return std::ranges::views::all(map_); }
 
+    /** Call f(e, seg) for every line segment seg, on path number e, whose bounding box
+     * may overlap the query box.  Paths must not be changed by f. */
+    template<typename F>
+    void segments_near(segbox const &q, F &&f) const
+    {
+        refresh_index();
+        index_.query(q, [this,&f](std::size_t i) { f(segs_[i].first, segment(i)); });
+    }
+    /** Call f(e, seg) for every line segment seg, on path number e, which may be hit by a ray
+     * going right from p (see intersects(lineseg const &, point)).  Paths must not be changed by f. */
+    template<typename F>
+    void segments_right_of(point p, F &&f) const
+    {
+        refresh_index();
+        index_.ray(p, [this,&f](std::size_t i) { f(segs_[i].first, segment(i)); });
+    }
+
     /** Provide read-only access to the paths container */
     decltype(map_) const &map() const noexcept { return map_; }
 
-    /** All branch points
+    /** All branch points, in order of point id.
+     * The list is kept until paths are added or split, which are the only ways use counts change
+     * (other than through the point factory directly)
      * Throws BadWorld if an isolated point is found */
-    [[nodiscard]] auto branch_points()
-    {
-        auto filter = [](pathpoint x) -> bool
-        {
-            auto i = x->use_count();
-            if(i == 1) {
-                std::ostringstream msg;
-                msg << "Unconnected line segment found at " << x;
-                throw BadWorld(msg.view());
-            }
-            return i>2;
-        };
-        return alloc_.points() | std::ranges::views::filter(filter);
-    }
+    [[nodiscard]] std::vector<pathpoint> const &branch_points();
+
+    /** Is p a branch point (a node of degree > 2)?  Every segment end counts a use of its point,
+     * and use counts are kept up to date as paths are added and split, so this is O(1) */
+    [[nodiscard]] bool is_branch_point(pathpoint p) const noexcept { return alloc_.use_count(p) > 2; }
+
+    /** Is p the end of a line segment which meets no other (as branch_points checks)?  O(1) */
+    [[nodiscard]] bool is_unconnected(pathpoint p) const noexcept { return alloc_.use_count(p) == 1; }
 
     auto points() { return alloc_.points(); }
 
+    /** Coordinate columns of all points, indexed by point id */
+    [[nodiscard]] auto xs() const noexcept { return alloc_.xs(); }
+    [[nodiscard]] auto ys() const noexcept { return alloc_.ys(); }
+
+    /** Select how points are snapped to the grid (see pntalloc::snap_type_t) */
+    void snapping(pntalloc::snap_type_t snap) noexcept { alloc_.snapping(snap); }
+
     /** Forward point construction */
     pathpoint make_point(double x, double y) { return alloc_.make_point(x, y); }
 